@@ -0,0 +1,59 @@
+/*
+Host stand-in for the I2C lcd. Keeps the 16x2 characters in memory and counts
+every character and command that would go over the I2C bus.
+*/
+#pragma once
+
+#include "Arduino.h"
+
+class Adafruit_LiquidCrystal : public Print {
+public:
+    explicit Adafruit_LiquidCrystal(uint8_t){ begin(16, 2); }
+
+    void begin(uint8_t columns_count, uint8_t rows_count){
+        columns = columns_count;
+        rows = rows_count;
+        clear();
+    }
+    void clear(){
+        memset(cells, ' ', sizeof(cells));
+        column = 0;
+        row = 0;
+        ++commands;
+    }
+    void setCursor(uint8_t new_column, uint8_t new_row){
+        column = new_column;
+        row = new_row;
+        ++commands;
+    }
+    void cursor(){ cursor_on = true; ++commands; }
+    void noCursor(){ cursor_on = false; ++commands; }
+    void setBacklight(uint8_t on){ backlight = on; ++commands; }
+    size_t write(uint8_t c) override {
+        if(column < columns && row < rows){
+            cells[row][column] = c;
+        }
+        ++column;
+        ++characters;
+        return 1;
+    }
+    using Print::write;
+
+    /* Text of a row as shown on the lcd */
+    const char* text(int index){
+        memcpy(row_text, cells[index], 16);
+        row_text[16] = 0;
+        return row_text;
+    }
+
+    uint8_t columns = 16;
+    uint8_t rows = 2;
+    char cells[2][16];
+    char row_text[17];
+    uint8_t column = 0;
+    uint8_t row = 0;
+    bool cursor_on = false;
+    uint8_t backlight = 1;
+    unsigned long characters = 0; // characters sent to lcd
+    unsigned long commands = 0; // clear, setCursor and other commands sent to lcd
+};
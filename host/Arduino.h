@@ -0,0 +1,104 @@
+/*
+Host implementation of the Arduino API used by kod.cpp.
+Pins, clock and serial port are backed by a simulated world (see hal.h) instead of hardware,
+so the sketch compiles unchanged on Linux and its logic runs against a plant model.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+// Arduino Uno analog pins
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define NUM_PINS 20
+
+// Flash and RAM are the same on the host
+#define PROGMEM
+#define PSTR(s) (s)
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+inline uint8_t pgm_read_byte(const void* address){ return *(const uint8_t*)address; }
+inline uint16_t pgm_read_word(const void* address){ return *(const uint16_t*)address; }
+inline void* memcpy_P(void* destination, const void* source, size_t size){ return memcpy(destination, source, size); }
+inline size_t strlen_P(const char* text){ return strlen(text); }
+inline int strcmp_P(const char* text, const char* text_P){ return strcmp(text, text_P); }
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout = 1000000UL);
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration = 0);
+void noTone(uint8_t pin);
+void shiftOut(uint8_t data_pin, uint8_t clock_pin, uint8_t bit_order, uint8_t value);
+inline void noInterrupts(){}
+inline void interrupts(){}
+
+// The Arduino core has these as macros, templates keep them out of the way of the C++ library
+template <class A, class B>
+inline auto min(A a, B b) -> decltype(true ? A() : B()){ return b < a ? b : a; }
+template <class A, class B>
+inline auto max(A a, B b) -> decltype(true ? A() : B()){ return a < b ? b : a; }
+template <class T, class L, class H>
+inline T constrain(T x, L low, H high){ return x < low ? low : (x > high ? high : x); }
+
+/* Text output, same overloads as the Arduino core */
+class Print {
+public:
+    virtual ~Print(){}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* text){ return text == 0 ? 0 : write((const uint8_t*)text, strlen(text)); }
+    virtual int availableForWrite(){ return 0; }
+    virtual void flush(){}
+
+    size_t print(const __FlashStringHelper* text){ return print(reinterpret_cast<const char*>(text)); }
+    size_t print(const char* text){ return write(text); }
+    size_t print(char c){ return write((uint8_t)c); }
+    size_t print(int value){ return print((long)value); }
+    size_t print(unsigned int value){ return print((unsigned long)value); }
+    size_t print(long value);
+    size_t print(unsigned long value);
+    size_t println(){ return write("\r\n"); }
+    template <class T>
+    size_t println(T value){ size_t n = print(value); return n + println(); }
+};
+
+/* Serial port, output goes to stdout and input comes from the simulated world */
+class HardwareSerial : public Print {
+public:
+    void begin(unsigned long baud);
+    void end(){}
+    int available();
+    int read();
+    int peek();
+    int availableForWrite() override;
+    size_t write(uint8_t c) override;
+    using Print::write;
+    operator bool(){ return true; }
+};
+
+extern HardwareSerial Serial;
@@ -0,0 +1,18 @@
+/*
+Host implementation of the Arduino EEPROM library used by kod.cpp.
+Contents live in hal.cpp, erased to 0xFF by hal::reset(), and only last for one run.
+*/
+#pragma once
+
+#include <stdint.h>
+
+class EEPROMClass {
+public:
+    uint8_t read(int address);
+    void write(int address, uint8_t value);
+    /* Write only when the value differs, like the board to save wear */
+    void update(int address, uint8_t value);
+    uint16_t length();
+};
+
+extern EEPROMClass EEPROM;
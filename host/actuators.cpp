@@ -0,0 +1,58 @@
+#include "actuators.h"
+#include "Arduino.h"
+#include "hal.h"
+
+#include <stdio.h>
+
+ActuatorLog::ActuatorLog(const ActuatorWiring& actuator_wiring) : wiring(actuator_wiring){
+    for (int zone = 0; zone < wiring.zones; ++zone)
+    {
+        names.push_back("pump" + std::to_string(zone));
+    }
+    for (const char* name : {"lamp", "lift", "buzzer", "red", "green", "blue"})
+    {
+        names.push_back(name);
+    }
+    last.assign(names.size(), 0);
+}
+
+void ActuatorLog::read(std::vector<int>& outputs) const {
+    outputs.clear();
+    uint32_t shift = hal::shift_register_outputs();
+    for (int zone = 0; zone < wiring.zones; ++zone)
+    {
+        if(wiring.zones == 1){
+            outputs.push_back(hal::pin_output(wiring.pump) > 0);
+        }else{
+            outputs.push_back((shift >> (wiring.shift_pump_bit + zone)) & 1);
+        }
+    }
+    outputs.push_back(hal::pin_output(wiring.lamp));
+    int direction = hal::pin(wiring.motor_input1).level - hal::pin(wiring.motor_input2).level;
+    outputs.push_back(direction * hal::pin_output(wiring.motor_pwm));
+    outputs.push_back(hal::tone_frequency(wiring.buzzer));
+    if(wiring.zones == 1){
+        outputs.push_back(hal::pin_output(wiring.red));
+        outputs.push_back(hal::pin_output(wiring.green));
+        outputs.push_back(hal::pin_output(wiring.blue));
+    }else{
+        for (int i = 0; i < 3; ++i)
+        {
+            outputs.push_back(((shift >> (wiring.shift_red_bit + i)) & 1) * 255);
+        }
+    }
+}
+
+void ActuatorLog::sample(std::vector<std::string>& lines){
+    read(values);
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        if(values[i] != last[i]){
+            char line[64];
+            snprintf(line, sizeof(line), "%llu,%s,%d", (unsigned long long)(hal::now_us() / 1000), names[i].c_str(), values[i]);
+            lines.push_back(line);
+            last[i] = values[i];
+            ++changes;
+        }
+    }
+}
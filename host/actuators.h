@@ -0,0 +1,46 @@
+/*
+Actuator stream of the sketch, a line time_ms,actuator,value for every change of an output.
+Two builds given the same inputs write the same stream unless their control logic differs,
+plant_sim and trace_replay write it with --actuators.
+*/
+#pragma once
+
+#include <string>
+#include <vector>
+
+const char* const ACTUATOR_HEADER = "time_ms,actuator,value";
+
+/* Pins and shift register outputs of the sketch that drive actuators */
+struct ActuatorWiring {
+    int zones = 1;
+    int pump = -1; // with one zone
+    int shift_pump_bit = -1; // with more zones the pump of zone 0 is this shift register output, the others follow
+    int lamp = -1;
+    int motor_input1 = -1; // HIGH with input2 LOW lifts the arm
+    int motor_input2 = -1;
+    int motor_pwm = -1;
+    int buzzer = -1;
+    int red = -1; // RGB led with one zone
+    int green = -1;
+    int blue = -1;
+    int shift_red_bit = -1; // with more zones red is this shift register output, green and blue follow
+};
+
+class ActuatorLog {
+public:
+    explicit ActuatorLog(const ActuatorWiring& wiring);
+
+    /* Add a line to lines for every output that changed since the last call, outputs start at 0 */
+    void sample(std::vector<std::string>& lines);
+
+    unsigned long changes = 0;
+
+private:
+    /* Value of every actuator now, in the order of names */
+    void read(std::vector<int>& values) const;
+
+    ActuatorWiring wiring;
+    std::vector<std::string> names;
+    std::vector<int> last;
+    std::vector<int> values;
+};
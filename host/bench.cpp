@@ -0,0 +1,252 @@
+/*
+Microbenchmarks of the hot paths of kod.cpp on the host.
+
+usage: bench [--rounds N] [--ms M] [--baseline FILE] [--tolerance PERCENT] [NAME...]
+
+Every benchmark calls one function of the sketch, or a whole loop() pass, against a world that
+always gives the same sensor values and the lcd stand-in. Calls are counted out so a round takes
+about M ms (20 by default), the result is the median of N rounds (7 by default), which keeps it
+steady from run to run on a quiet machine. A global operator new counts heap allocations, the
+board has no heap to spare so any allocation in these paths is a regression by itself.
+
+Prints NAME_ns and NAME_allocs per call, one key=value a line. --baseline reads that output of an
+earlier run and exits with 1 when a benchmark got slower by more than --tolerance percent (25 by
+default) or allocates more. Names given on the command line run only those benchmarks.
+*/
+#include "Arduino.h"
+#include "../kod.cpp"
+
+#include "hal.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+unsigned long allocations = 0;
+
+}
+
+void* operator new(size_t size){
+    ++allocations;
+    void* memory = malloc(size == 0 ? 1 : size);
+    if(memory == 0){
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void* operator new[](size_t size){
+    return operator new(size);
+}
+
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept {
+    free(memory);
+}
+
+namespace {
+
+const int WARM_UP_MS = 10000; // board time for the sensor filters to fill before measuring
+const double TEMPERATURE_C = 22;
+const int LIGHT_CODE = 450;
+const int SOIL_CODE = 600;
+
+/* Sensors that never change, the arm resting at the gap */
+class SteadyWorld : public SimWorld {
+public:
+    int digital_input(int) override {
+        return LOW;
+    }
+    int analog_input(int pin) override {
+        if(pin == TEMPERATURE_PIN){
+            return (int)((500 + 10 * TEMPERATURE_C) * 1024 / 5000); // TMP36
+        }
+        return pin == LIGHT_SENSOR_PIN ? LIGHT_CODE : SOIL_CODE;
+    }
+    unsigned long echo_time(int) override {
+        return (unsigned long)(distance_gap / 0.01723);
+    }
+};
+
+volatile long sink; // results go here so the calls are not optimized away
+
+struct Benchmark {
+    const char* name;
+    void (*run)();
+};
+
+const Benchmark BENCHMARKS[] = {
+    {"read_temperature", []{ sink = read_temperature(TEMPERATURE_PIN); }},
+    {"read_light_intensity", []{ sink = read_light_intensity(); }},
+    {"read_soil_moisture", []{ sink = read_soil_moisture(0); }},
+    {"water_plants", []{ water_plants(0); }},
+    {"keep_gap", []{ keep_gap(gap_tolerance); }},
+    {"check_light", []{ check_light(); }},
+    {"alert", []{ alert(); }},
+    {"safety_task", []{ safety_task(); }},
+    {"safety_feed", []{ safety_feed(); }},
+    {"print_sensors_values", []{ print_sensors_values(); }},
+    // a pass for every ms of board time, most find no task due
+    {"loop", []{ hal::advance_us(1000); loop(); }},
+};
+
+struct Result {
+    double ns;
+    double allocs;
+};
+
+/* ns and allocations per call of one round of count calls */
+Result run_round(const Benchmark& benchmark, unsigned long count){
+    unsigned long allocations_before = allocations;
+    auto started = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < count; ++i)
+    {
+        benchmark.run();
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count();
+    return {ns / count, (double)(allocations - allocations_before) / count};
+}
+
+/* Median ns and mean allocations per call over rounds of about round_ms */
+Result measure(const Benchmark& benchmark, int rounds, double round_ms){
+    // double the calls until they take a tenth of a round, then scale up to a round
+    unsigned long count = 1;
+    double ns_per_call;
+    while((ns_per_call = run_round(benchmark, count).ns) * count < round_ms * 1e6 / 10){
+        count *= 2;
+    }
+    count = std::max(1UL, (unsigned long)(round_ms * 1e6 / ns_per_call));
+    std::vector<double> ns;
+    double allocs = 0;
+    for (int round = 0; round < rounds; ++round)
+    {
+        Result result = run_round(benchmark, count);
+        ns.push_back(result.ns);
+        allocs += result.allocs;
+    }
+    std::sort(ns.begin(), ns.end());
+    return {ns[ns.size() / 2], allocs / rounds};
+}
+
+/* key=value lines of an earlier run */
+bool read_baseline(const char* path, std::map<std::string, double>& values){
+    FILE* file = fopen(path, "r");
+    if(file == 0){
+        perror(path);
+        return false;
+    }
+    char line[256];
+    while(fgets(line, sizeof(line), file) != 0){
+        char* equals = strchr(line, '=');
+        if(equals != 0){
+            *equals = 0;
+            values[line] = atof(equals + 1);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+void usage(){
+    fprintf(stderr, "usage: bench [--rounds N] [--ms M] [--baseline FILE] [--tolerance PERCENT] [NAME...]\n");
+    exit(2);
+}
+
+}
+
+int main(int argc, char** argv){
+    int rounds = 7;
+    double round_ms = 20;
+    double tolerance = 25;
+    const char* baseline_path = 0;
+    std::vector<std::string> names;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* option = argv[i];
+        if(option[0] != '-'){
+            names.push_back(option);
+            continue;
+        }
+        if(i + 1 >= argc){
+            usage();
+        }
+        const char* value = argv[++i];
+        if(strcmp(option, "--rounds") == 0){
+            rounds = atoi(value);
+        }else if(strcmp(option, "--ms") == 0){
+            round_ms = atof(value);
+        }else if(strcmp(option, "--baseline") == 0){
+            baseline_path = value;
+        }else if(strcmp(option, "--tolerance") == 0){
+            tolerance = atof(value);
+        }else{
+            usage();
+        }
+    }
+    if(rounds < 1 || round_ms <= 0){
+        usage();
+    }
+    std::map<std::string, double> baseline;
+    if(baseline_path != 0 && !read_baseline(baseline_path, baseline)){
+        return 1;
+    }
+
+    SteadyWorld world;
+    hal::serial_output(0);
+    hal::attach(&world);
+    if(ZONE_COUNT > 1){
+        hal::wire_shift_register(SHIFT_DATA_PIN, SHIFT_CLOCK_PIN, SHIFT_LATCH_PIN);
+    }
+    setup();
+    for (int ms = 0; ms < WARM_UP_MS; ++ms)
+    {
+        hal::advance_us(1000);
+        loop();
+    }
+
+    printf("rounds=%d\n", rounds);
+    printf("round_ms=%g\n", round_ms);
+    unsigned long regressions = 0;
+    for (const Benchmark& benchmark : BENCHMARKS)
+    {
+        if(!names.empty() && std::find(names.begin(), names.end(), benchmark.name) == names.end()){
+            continue;
+        }
+        Result result = measure(benchmark, rounds, round_ms);
+        std::string ns_key = std::string(benchmark.name) + "_ns";
+        std::string allocs_key = std::string(benchmark.name) + "_allocs";
+        printf("%s=%.1f\n", ns_key.c_str(), result.ns);
+        printf("%s=%.2f\n", allocs_key.c_str(), result.allocs);
+        if(baseline.count(ns_key) && result.ns > baseline[ns_key] * (1 + tolerance / 100)){
+            fprintf(stderr, "%s: %.1f ns, was %.1f ns\n", benchmark.name, result.ns, baseline[ns_key]);
+            ++regressions;
+        }
+        if(baseline.count(allocs_key) && result.allocs > baseline[allocs_key] + 0.005){
+            fprintf(stderr, "%s: %.2f allocations, was %.2f\n", benchmark.name, result.allocs, baseline[allocs_key]);
+            ++regressions;
+        }
+    }
+    if(baseline_path != 0){
+        printf("regressions=%lu\n", regressions);
+    }
+    return regressions > 0 ? 1 : 0;
+}
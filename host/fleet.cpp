@@ -0,0 +1,420 @@
+/*
+Runs plant_sim for many configurations at once and prints a CSV line of results per run.
+
+usage: fleet [--jobs N] [--hours H] [--seeds N] [--random N] [--random-seed N] [--sim PATH] SWEEP...
+
+SWEEP is NAME=FROM:TO:STEP for a grid or NAME=A,B,C for a list. NAME is a setpoint of the sketch
+by its serial command name (tmin, tmax, light, band, gap, tol, soil) or plant.FIELD for a field of
+PlantConfig, see plant_sim --plant. A grid runs every combination of the sweeps; --random N draws
+N configurations instead, each value uniformly from FROM to TO or one of the list, setpoints as
+whole numbers. Every configuration runs --seeds times, with plant seeds 1 to N.
+
+kod.cpp keeps its state in globals, so every run is a plant_sim process of its own. --jobs threads,
+one per core by default, start runs from their own queue and steal from the back of another
+queue when theirs is empty, so no core idles while another still has a backlog. Columns are
+the sweep values and water, actuator cycles, time out of the setpoint bands and alerts of the run.
+The summary on stderr gives simulated controller hours per second of wall time.
+*/
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern char** environ;
+
+namespace {
+
+// Summary lines of plant_sim given for every run, in the order of the columns
+const char* const METRICS[] = {
+    "water_ml", "pump_cycles", "lamp_switches", "lamp_energy_wh", "motor_reversals", "motor_seconds",
+    "dry_minutes", "gap_error_minutes", "alerts", "alert_minutes", "warnings", "buzzer_minutes",
+};
+
+/* Values one setting takes */
+struct Sweep {
+    std::string name;
+    bool plant; // a PlantConfig field, else a setpoint
+    bool range; // values from..to, else the list
+    double from;
+    double to;
+    double step;
+    std::vector<double> values;
+};
+
+struct Options {
+    int jobs = std::thread::hardware_concurrency();
+    double hours = 24;
+    int seeds = 1;
+    int random = 0; // configurations to draw, 0 for a grid
+    unsigned random_seed = 1;
+    std::string sim;
+};
+
+/* A configuration and the plant seed it runs with */
+struct Run {
+    std::vector<double> values; // one per sweep
+    int seed;
+    bool ok = false;
+    std::map<std::string, std::string> results; // summary lines of plant_sim
+};
+
+/*
+Threads that run indexed jobs. Each has a queue of its own, a thread that runs out takes from
+the back of another queue, the job furthest from being started by its owner.
+*/
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(int threads) : queues(threads){
+        for (auto& queue : queues)
+        {
+            queue.reset(new Queue);
+        }
+    }
+
+    /* Call job(index) for every index below count, returns when all of them are done */
+    void run(size_t count, const std::function<void(size_t)>& job){
+        // neighbouring jobs go to the same thread, they often cost about the same
+        size_t threads = queues.size();
+        for (size_t i = 0; i < count; ++i)
+        {
+            queues[i * threads / count]->jobs.push_back(i);
+        }
+        std::vector<std::thread> workers;
+        for (size_t self = 0; self < threads; ++self)
+        {
+            workers.emplace_back([this, self, &job]{
+                size_t index;
+                while(take(self, index)){
+                    job(index);
+                }
+            });
+        }
+        for (std::thread& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    unsigned long steals() const {
+        return steal_count;
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> jobs;
+    };
+
+    /* Next job of a thread, false when no queue has one left */
+    bool take(size_t self, size_t& index){
+        {
+            Queue& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if(!own.jobs.empty()){
+                index = own.jobs.front();
+                own.jobs.pop_front();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); ++i)
+        {
+            Queue& other = *queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(other.mutex);
+            if(!other.jobs.empty()){
+                index = other.jobs.back();
+                other.jobs.pop_back();
+                ++steal_count;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::atomic<unsigned long> steal_count{0};
+};
+
+void usage(){
+    fprintf(stderr, "usage: fleet [--jobs N] [--hours H] [--seeds N] [--random N] [--random-seed N] [--sim PATH] SWEEP...\n"
+                    "SWEEP is NAME=FROM:TO:STEP or NAME=A,B,C, NAME a setpoint or plant.FIELD\n");
+    exit(2);
+}
+
+/* Sweep from NAME=FROM:TO:STEP or NAME=A,B,C, false when it is neither */
+bool parse_sweep(const char* text, Sweep& sweep){
+    const char* values = strchr(text, '=');
+    if(values == 0 || values == text){
+        return false;
+    }
+    sweep.name.assign(text, values - text);
+    sweep.plant = sweep.name.compare(0, 6, "plant.") == 0;
+    if(sweep.plant){
+        sweep.name.erase(0, 6);
+    }
+    ++values;
+    sweep.range = strchr(values, ':') != 0;
+    if(sweep.range){
+        sweep.step = 0;
+        int count = sscanf(values, "%lf:%lf:%lf", &sweep.from, &sweep.to, &sweep.step);
+        if(count < 2 || sweep.to < sweep.from || sweep.step < 0){
+            return false;
+        }
+        // a range without a step can only be drawn from
+        for (double value = sweep.from; sweep.step > 0 && value <= sweep.to + sweep.step * 1e-9; value += sweep.step)
+        {
+            sweep.values.push_back(value);
+        }
+        return true;
+    }
+    for (const char* value = values; *value != 0; )
+    {
+        char* end;
+        sweep.values.push_back(strtod(value, &end));
+        if(end == value || (*end != ',' && *end != 0)){
+            return false;
+        }
+        value = (*end == ',') ? end + 1 : end;
+    }
+    return !sweep.values.empty();
+}
+
+/* Every combination of the sweep values, the last sweep changes fastest */
+std::vector<std::vector<double>> grid(const std::vector<Sweep>& sweeps){
+    std::vector<std::vector<double>> configurations(1);
+    for (const Sweep& sweep : sweeps)
+    {
+        std::vector<std::vector<double>> next;
+        for (const auto& configuration : configurations)
+        {
+            for (double value : sweep.values)
+            {
+                next.push_back(configuration);
+                next.back().push_back(value);
+            }
+        }
+        configurations.swap(next);
+    }
+    return configurations;
+}
+
+/* count configurations with every value drawn from its sweep */
+std::vector<std::vector<double>> draw(const std::vector<Sweep>& sweeps, int count, unsigned seed){
+    std::mt19937 random(seed);
+    std::vector<std::vector<double>> configurations(count);
+    for (auto& configuration : configurations)
+    {
+        for (const Sweep& sweep : sweeps)
+        {
+            double value;
+            if(sweep.range){
+                if(sweep.plant){
+                    value = std::uniform_real_distribution<double>(sweep.from, sweep.to)(random);
+                }else{
+                    value = std::uniform_int_distribution<int>((int)sweep.from, (int)sweep.to)(random);
+                }
+            }else{
+                value = sweep.values[std::uniform_int_distribution<size_t>(0, sweep.values.size() - 1)(random)];
+            }
+            configuration.push_back(value);
+        }
+    }
+    return configurations;
+}
+
+/*
+Run a program and collect what it writes to stdout
+@return bool false when it could not start or did not exit with 0
+*/
+bool run_program(const std::vector<std::string>& args, std::string& output){
+    int pipe_fds[2];
+    if(pipe2(pipe_fds, O_CLOEXEC) != 0){
+        return false;
+    }
+    // the write end must not leak into programs other threads start, only the dup on stdout stays open
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDOUT_FILENO);
+    std::vector<char*> argv;
+    for (const std::string& arg : args)
+    {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(0);
+    pid_t pid;
+    int error = posix_spawn(&pid, argv[0], &actions, 0, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pipe_fds[1]);
+    if(error != 0){
+        close(pipe_fds[0]);
+        return false;
+    }
+    char buffer[4096];
+    ssize_t size;
+    while((size = read(pipe_fds[0], buffer, sizeof(buffer))) > 0){
+        output.append(buffer, size);
+    }
+    close(pipe_fds[0]);
+    int status;
+    while(waitpid(pid, &status, 0) < 0){
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* plant_sim arguments of a run */
+std::vector<std::string> sim_args(const Options& options, const std::vector<Sweep>& sweeps, const Run& run){
+    std::vector<std::string> args = {options.sim, "--hours", std::to_string(options.hours), "--seed", std::to_string(run.seed)};
+    for (size_t i = 0; i < sweeps.size(); ++i)
+    {
+        char value[32];
+        if(sweeps[i].plant){
+            snprintf(value, sizeof(value), "%g", run.values[i]);
+        }else{
+            snprintf(value, sizeof(value), "%d", (int)run.values[i]);
+        }
+        args.push_back(sweeps[i].plant ? "--plant" : "--setpoint");
+        args.push_back(sweeps[i].name + "=" + value);
+    }
+    return args;
+}
+
+/* Summary lines NAME=VALUE of plant_sim */
+std::map<std::string, std::string> parse_results(const std::string& output){
+    std::map<std::string, std::string> results;
+    size_t start = 0;
+    while(start < output.size()){
+        size_t end = output.find('\n', start);
+        if(end == std::string::npos){
+            end = output.size();
+        }
+        size_t equals = output.find('=', start);
+        if(equals < end){
+            results[output.substr(start, equals - start)] = output.substr(equals + 1, end - equals - 1);
+        }
+        start = end + 1;
+    }
+    return results;
+}
+
+}
+
+int main(int argc, char** argv){
+    Options options;
+    std::vector<Sweep> sweeps;
+    std::string program = argv[0];
+    size_t slash = program.rfind('/');
+    options.sim = (slash == std::string::npos ? std::string(".") : program.substr(0, slash)) + "/plant_sim";
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* option = argv[i];
+        if(option[0] != '-'){
+            Sweep sweep;
+            if(!parse_sweep(option, sweep)){
+                usage();
+            }
+            sweeps.push_back(sweep);
+            continue;
+        }
+        if(i + 1 >= argc){
+            usage();
+        }
+        const char* value = argv[++i];
+        if(strcmp(option, "--jobs") == 0){
+            options.jobs = atoi(value);
+        }else if(strcmp(option, "--hours") == 0){
+            options.hours = atof(value);
+        }else if(strcmp(option, "--seeds") == 0){
+            options.seeds = atoi(value);
+        }else if(strcmp(option, "--random") == 0){
+            options.random = atoi(value);
+        }else if(strcmp(option, "--random-seed") == 0){
+            options.random_seed = atoi(value);
+        }else if(strcmp(option, "--sim") == 0){
+            options.sim = value;
+        }else{
+            usage();
+        }
+    }
+    if(options.jobs < 1 || options.seeds < 1 || options.hours <= 0){
+        usage();
+    }
+    for (const Sweep& sweep : sweeps)
+    {
+        if(options.random == 0 && sweep.values.empty()){
+            fprintf(stderr, "%s: a grid needs FROM:TO:STEP\n", sweep.name.c_str());
+            return 2;
+        }
+    }
+
+    std::vector<Run> runs;
+    for (const auto& configuration : options.random > 0 ? draw(sweeps, options.random, options.random_seed) : grid(sweeps))
+    {
+        for (int seed = 1; seed <= options.seeds; ++seed)
+        {
+            Run run;
+            run.values = configuration;
+            run.seed = seed;
+            runs.push_back(run);
+        }
+    }
+
+    WorkStealingPool pool(options.jobs);
+    auto started = std::chrono::steady_clock::now();
+    pool.run(runs.size(), [&](size_t index){
+        Run& run = runs[index];
+        std::string output;
+        run.ok = run_program(sim_args(options, sweeps, run), output);
+        run.results = parse_results(output);
+    });
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    printf("run,seed");
+    for (const Sweep& sweep : sweeps)
+    {
+        printf(",%s%s", sweep.plant ? "plant." : "", sweep.name.c_str());
+    }
+    for (const char* metric : METRICS)
+    {
+        printf(",%s", metric);
+    }
+    printf("\n");
+    unsigned long failed = 0;
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        const Run& run = runs[i];
+        if(!run.ok){
+            ++failed;
+            continue;
+        }
+        printf("%zu,%d", i, run.seed);
+        for (double value : run.values)
+        {
+            printf(",%g", value);
+        }
+        for (const char* metric : METRICS)
+        {
+            auto result = run.results.find(metric);
+            printf(",%s", result == run.results.end() ? "" : result->second.c_str());
+        }
+        printf("\n");
+    }
+    double controller_hours = (runs.size() - failed) * options.hours;
+    fprintf(stderr, "runs=%zu\nfailed_runs=%lu\njobs=%d\nsteals=%lu\nwall_seconds=%.3f\ncontroller_hours=%.1f\n"
+                    "controller_hours_per_second=%.2f\n",
+        runs.size(), failed, options.jobs, pool.steals(), wall_s, controller_hours, controller_hours / wall_s);
+    return failed > 0 ? 1 : 0;
+}
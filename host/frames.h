@@ -0,0 +1,113 @@
+/*
+Reading the binary frames kod.cpp sends over serial, see "Serial frames" there:
+a payload and its CRC-16/CCITT, COBS encoded and ended by a 0 byte.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+// kod.cpp has its own crc16_update() and is compiled into the same programs
+namespace frames {
+
+/* Bytes up to the next 0, skipping empty frames, false when the input ends first */
+inline bool read_frame(FILE* input, std::vector<uint8_t>& frame){
+    frame.clear();
+    int c;
+    while((c = fgetc(input)) != EOF){
+        if(c != 0){
+            frame.push_back(c);
+        }else if(!frame.empty()){
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Undo COBS, false when a code points past the end or a 0 is inside the frame */
+inline bool cobs_decode(const std::vector<uint8_t>& frame, std::vector<uint8_t>& payload){
+    payload.clear();
+    size_t i = 0;
+    while(i < frame.size()){
+        uint8_t code = frame[i++];
+        if(code == 0 || i + code - 1 > frame.size()){
+            return false;
+        }
+        for (int j = 1; j < code; ++j)
+        {
+            payload.push_back(frame[i++]);
+        }
+        if(code < 0xFF && i < frame.size()){
+            payload.push_back(0);
+        }
+    }
+    return true;
+}
+
+inline uint16_t crc16_update(uint16_t crc, uint8_t value){
+    crc ^= (uint16_t)value << 8;
+    for (int i = 0; i < 8; ++i)
+    {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+/* Decode a frame and check its CRC, payload is left without the CRC */
+inline bool frame_payload(const std::vector<uint8_t>& frame, std::vector<uint8_t>& payload){
+    if(!cobs_decode(frame, payload) || payload.size() < 3){
+        return false;
+    }
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i + 2 < payload.size(); ++i)
+    {
+        crc = crc16_update(crc, payload[i]);
+    }
+    if(crc != (payload[payload.size() - 2] << 8 | payload[payload.size() - 1])){
+        return false;
+    }
+    payload.resize(payload.size() - 2);
+    return true;
+}
+
+/* Reads varints from a payload, ok turns false when one runs past the end */
+struct Reader {
+    const std::vector<uint8_t>& data;
+    size_t position;
+    bool ok;
+
+    bool done() const {
+        return position >= data.size();
+    }
+
+    uint8_t byte(){
+        if(position >= data.size()){
+            ok = false;
+            return 0;
+        }
+        return data[position++];
+    }
+
+    unsigned long varint(){
+        unsigned long value = 0;
+        for (int shift = 0; shift < 35; shift += 7)
+        {
+            uint8_t next = byte();
+            value |= (unsigned long)(next & 0x7F) << shift;
+            if((next & 0x80) == 0){
+                return value;
+            }
+        }
+        ok = false;
+        return 0;
+    }
+
+    long zigzag(){
+        unsigned long value = varint();
+        return (value & 1) ? -(long)(value >> 1) - 1 : (long)(value >> 1);
+    }
+};
+
+}
@@ -0,0 +1,334 @@
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "hal.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+SimWorld* world = 0;
+uint64_t clock_us = 0;
+SimPin pins[NUM_PINS];
+unsigned int tones[NUM_PINS];
+uint64_t tone_end_us[NUM_PINS];
+std::string serial_rx;
+size_t serial_rx_position = 0;
+FILE* serial_tx = stdout;
+const int SERIAL_TX_BUFFER = 63; // bytes availableForWrite() reports on an empty Uno buffer
+unsigned long serial_baud = 0; // 0 before Serial.begin(), output is then not paced
+double serial_tx_queued = 0; // bytes in the transmit buffer at serial_tx_time
+uint64_t serial_tx_time = 0;
+unsigned long serial_tx_count = 0;
+unsigned long serial_tx_blocked = 0;
+const int EEPROM_BYTES = 1024; // ATmega328P
+std::vector<uint8_t> eeprom(EEPROM_BYTES, 0xFF); // erased
+unsigned long eeprom_write_count = 0;
+int shift_data_pin = -1; // 74HC595 chain, -1 when none is wired
+int shift_clock_pin = -1;
+int shift_latch_pin = -1;
+uint32_t shift_register = 0; // bits shifted in, first bit in the highest position
+uint32_t shift_latched = 0; // outputs
+
+/* Shift register clocks in the data level on a rising clock edge and copies it to the outputs on a rising latch edge */
+void shift_register_edge(int pin){
+    if(pin == shift_clock_pin){
+        shift_register = shift_register << 1 | (pins[shift_data_pin].level == HIGH);
+    }else if(pin == shift_latch_pin){
+        shift_latched = shift_register;
+    }
+}
+
+bool valid_pin(int pin){
+    return pin >= 0 && pin < NUM_PINS;
+}
+
+/* Take out of the transmit buffer what the UART sent since last time, 10 bits per byte */
+void drain_serial_tx(){
+    serial_tx_queued -= (clock_us - serial_tx_time) * serial_baud / 10e6;
+    if(serial_tx_queued < 0){
+        serial_tx_queued = 0;
+    }
+    serial_tx_time = clock_us;
+}
+
+}
+
+HardwareSerial Serial;
+
+namespace hal {
+
+void attach(SimWorld* new_world){
+    world = new_world;
+}
+
+uint64_t now_us(){
+    return clock_us;
+}
+
+void advance_us(uint64_t us){
+    clock_us += us;
+}
+
+const SimPin& pin(int number){
+    static SimPin none = {INPUT, LOW, 0};
+    return valid_pin(number) ? pins[number] : none;
+}
+
+int pin_output(int number){
+    const SimPin& state = pin(number);
+    if(state.pwm > 0){
+        return state.pwm;
+    }
+    return state.level == HIGH ? 255 : 0;
+}
+
+unsigned int tone_frequency(int pin){
+    if(!valid_pin(pin)){
+        return 0;
+    }
+    if(tone_end_us[pin] != 0 && clock_us >= tone_end_us[pin]){
+        tones[pin] = 0;
+        tone_end_us[pin] = 0;
+    }
+    return tones[pin];
+}
+
+uint64_t tone_stop_us(int pin){
+    return valid_pin(pin) ? tone_end_us[pin] : 0;
+}
+
+void serial_input(const char* text){
+    serial_rx.append(text);
+}
+
+void serial_input(const uint8_t* data, unsigned long size){
+    serial_rx.append((const char*)data, size);
+}
+
+void serial_output(void* file){
+    serial_tx = (FILE*)file;
+}
+
+unsigned long serial_tx_bytes(){
+    return serial_tx_count;
+}
+
+unsigned long serial_blocked_writes(){
+    return serial_tx_blocked;
+}
+
+void wire_shift_register(int data_pin, int clock_pin, int latch_pin){
+    shift_data_pin = data_pin;
+    shift_clock_pin = clock_pin;
+    shift_latch_pin = latch_pin;
+}
+
+uint32_t shift_register_outputs(){
+    return shift_latched;
+}
+
+unsigned long eeprom_writes(){
+    return eeprom_write_count;
+}
+
+void reset(){
+    clock_us = 0;
+    memset(pins, 0, sizeof(pins));
+    memset(tones, 0, sizeof(tones));
+    memset(tone_end_us, 0, sizeof(tone_end_us));
+    serial_rx.clear();
+    serial_rx_position = 0;
+    serial_baud = 0;
+    serial_tx_queued = 0;
+    serial_tx_time = 0;
+    serial_tx_count = 0;
+    serial_tx_blocked = 0;
+    eeprom.assign(EEPROM_BYTES, 0xFF);
+    eeprom_write_count = 0;
+    shift_register = 0;
+    shift_latched = 0;
+}
+
+}
+
+void pinMode(uint8_t pin, uint8_t mode){
+    if(valid_pin(pin)){
+        pins[pin].mode = mode;
+    }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value){
+    if(valid_pin(pin)){
+        bool rising = value && pins[pin].level == LOW;
+        pins[pin].level = value ? HIGH : LOW;
+        pins[pin].pwm = 0;
+        if(rising){
+            shift_register_edge(pin);
+        }
+    }
+}
+
+int digitalRead(uint8_t pin){
+    if(!valid_pin(pin)){
+        return LOW;
+    }
+    if(pins[pin].mode == OUTPUT || world == 0){
+        return pins[pin].level;
+    }
+    return world->digital_input(pin);
+}
+
+int analogRead(uint8_t pin){
+    return world == 0 ? 0 : world->analog_input(pin);
+}
+
+void analogWrite(uint8_t pin, int value){
+    if(valid_pin(pin)){
+        if(value <= 0){
+            digitalWrite(pin, LOW);
+        }else if(value >= 255){
+            digitalWrite(pin, HIGH);
+        }else{
+            pins[pin].level = HIGH;
+            pins[pin].pwm = value;
+        }
+    }
+}
+
+unsigned long millis(){
+    return (unsigned long)(clock_us / 1000);
+}
+
+unsigned long micros(){
+    return (unsigned long)clock_us;
+}
+
+void delay(unsigned long ms){
+    clock_us += (uint64_t)ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us){
+    clock_us += us;
+}
+
+/*
+Returns at once without moving the clock, on the board the echo is timed by
+pin change interrupt while the sketch keeps running.
+*/
+unsigned long pulseIn(uint8_t pin, uint8_t, unsigned long timeout){
+    unsigned long duration = world == 0 ? 0 : world->echo_time(pin);
+    return duration > timeout ? 0 : duration;
+}
+
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration){
+    if(valid_pin(pin)){
+        tones[pin] = frequency;
+        tone_end_us[pin] = duration == 0 ? 0 : clock_us + (uint64_t)duration * 1000;
+    }
+}
+
+void noTone(uint8_t pin){
+    if(valid_pin(pin)){
+        tones[pin] = 0;
+        tone_end_us[pin] = 0;
+    }
+}
+
+void shiftOut(uint8_t data_pin, uint8_t clock_pin, uint8_t bit_order, uint8_t value){
+    for (int i = 0; i < 8; ++i)
+    {
+        int bit = bit_order == LSBFIRST ? i : 7 - i;
+        digitalWrite(data_pin, value >> bit & 1);
+        digitalWrite(clock_pin, HIGH);
+        digitalWrite(clock_pin, LOW);
+    }
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size){
+    size_t count = 0;
+    while(count < size && write(buffer[count])){
+        ++count;
+    }
+    return count;
+}
+
+size_t Print::print(long value){
+    char text[24];
+    snprintf(text, sizeof(text), "%ld", value);
+    return write(text);
+}
+
+size_t Print::print(unsigned long value){
+    char text[24];
+    snprintf(text, sizeof(text), "%lu", value);
+    return write(text);
+}
+
+void HardwareSerial::begin(unsigned long baud){
+    serial_baud = baud;
+    serial_tx_time = clock_us;
+}
+
+int HardwareSerial::available(){
+    return (int)(serial_rx.size() - serial_rx_position);
+}
+
+int HardwareSerial::read(){
+    if(serial_rx_position >= serial_rx.size()){
+        return -1;
+    }
+    return (uint8_t)serial_rx[serial_rx_position++];
+}
+
+int HardwareSerial::peek(){
+    if(serial_rx_position >= serial_rx.size()){
+        return -1;
+    }
+    return (uint8_t)serial_rx[serial_rx_position];
+}
+
+int HardwareSerial::availableForWrite(){
+    drain_serial_tx();
+    return SERIAL_TX_BUFFER - (int)ceil(serial_tx_queued);
+}
+
+size_t HardwareSerial::write(uint8_t c){
+    drain_serial_tx();
+    if(serial_baud > 0){
+        if(serial_tx_queued > SERIAL_TX_BUFFER - 1){
+            ++serial_tx_blocked; // the board would wait here for the UART
+        }
+        serial_tx_queued += 1;
+    }
+    ++serial_tx_count;
+    if(serial_tx != 0){
+        fputc(c, serial_tx);
+    }
+    return 1;
+}
+
+EEPROMClass EEPROM;
+
+uint8_t EEPROMClass::read(int address){
+    return (address >= 0 && address < EEPROM_BYTES) ? eeprom[address] : 0xFF;
+}
+
+void EEPROMClass::write(int address, uint8_t value){
+    if(address >= 0 && address < EEPROM_BYTES){
+        eeprom[address] = value;
+        ++eeprom_write_count;
+    }
+}
+
+void EEPROMClass::update(int address, uint8_t value){
+    if(read(address) != value){
+        write(address, value);
+    }
+}
+
+uint16_t EEPROMClass::length(){
+    return EEPROM_BYTES;
+}
@@ -0,0 +1,76 @@
+/*
+Simulated hardware behind host/Arduino.h.
+The world answers what the sketch reads from its pins, the virtual clock only moves
+when the simulation advances it, so hours of plant time run in a fraction of a second.
+*/
+#pragma once
+
+#include <stdint.h>
+
+/* What the sketch can sense, implemented by the plant model */
+class SimWorld {
+public:
+    virtual ~SimWorld(){}
+    /* Level of an input pin */
+    virtual int digital_input(int pin) = 0;
+    /* ADC code 0-1023 of an analog pin */
+    virtual int analog_input(int pin) = 0;
+    /* Length in microseconds of the echo pulse after a ping on pin, 0 when there is no echo */
+    virtual unsigned long echo_time(int pin) = 0;
+};
+
+/* State of one pin as last set by the sketch */
+struct SimPin {
+    int mode;
+    int level; // digitalWrite level
+    int pwm; // analogWrite duty 0-255
+};
+
+namespace hal {
+
+/* Connect the world that answers pin reads */
+void attach(SimWorld* world);
+
+/* Virtual clock in microseconds since start */
+uint64_t now_us();
+void advance_us(uint64_t us);
+
+/* Pin as last written by the sketch */
+const SimPin& pin(int number);
+
+/* Output level of a pin: analogWrite duty when set, else 255 for HIGH and 0 for LOW */
+int pin_output(int number);
+
+/* Buzzer tone, 0 when silent */
+unsigned int tone_frequency(int pin);
+
+/* Time a tone given a duration stops, 0 when the pin plays none */
+uint64_t tone_stop_us(int pin);
+
+/* Bytes the sketch will read from Serial */
+void serial_input(const char* text);
+void serial_input(const uint8_t* data, unsigned long size);
+
+/* Send Serial output to a file instead of stdout, 0 to drop it */
+void serial_output(void* file);
+
+/*
+Serial output is paced by the baud rate given to Serial.begin() through a 63 byte transmit buffer.
+Bytes the sketch wrote, and writes that found the buffer full and would wait on the board.
+*/
+unsigned long serial_tx_bytes();
+unsigned long serial_blocked_writes();
+
+/* Wire a chain of 74HC595 shift registers to three pins */
+void wire_shift_register(int data_pin, int clock_pin, int latch_pin);
+
+/* Latched shift register outputs, output 0 of the register nearest the data pin in bit 0 */
+uint32_t shift_register_outputs();
+
+/* EEPROM bytes written, a cell of the board lasts about 100000 writes */
+unsigned long eeprom_writes();
+
+/* Reset clock and pins for a new run */
+void reset();
+
+}
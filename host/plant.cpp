@@ -0,0 +1,180 @@
+#include "plant.h"
+#include "Arduino.h"
+
+#include <math.h>
+
+namespace {
+
+const double PI = 3.14159265358979;
+
+double clamp(double value, double low, double high){
+    return value < low ? low : (value > high ? high : value);
+}
+
+}
+
+Plant::Plant(const PlantWiring& plant_wiring, const PlantConfig& plant_config)
+    : wiring(plant_wiring), config(plant_config), random(plant_config.seed), noise(0, 1), uniform(0, 1){
+    pots.resize(wiring.zones);
+    for (Pot& pot : pots)
+    {
+        pot.soil_moisture = config.soil_moisture;
+    }
+    lamp_height = config.lamp_height;
+    plant_height = config.plant_height;
+    temperature = 21;
+}
+
+double Plant::hour_of_day() const {
+    return fmod(config.start_hour + time_s / 3600, 24);
+}
+
+void Plant::press(int pin, double at_s, double duration_s){
+    presses.push_back({pin, at_s, at_s + duration_s});
+}
+
+bool Plant::pump_on(int pot) const {
+    if(wiring.zones == 1){
+        return hal::pin_output(wiring.pump) > 0;
+    }
+    return (hal::shift_register_outputs() >> (wiring.shift_pump_bit + pot)) & 1;
+}
+
+void Plant::step(double seconds){
+    time_s += seconds;
+    double hour = hour_of_day();
+
+    // Pumps, water soaks into the soil before the sensor sees it
+    for (size_t i = 0; i < pots.size(); ++i)
+    {
+        Pot& pot = pots[i];
+        bool on = pump_on(i);
+        if(on){
+            double ml = config.pump_ml_per_s * seconds;
+            pot.water_in_transit_ml += ml;
+            pot.water_ml += ml;
+            counters.water_ml += ml;
+            counters.pump_seconds += seconds;
+            if(!pot.pump_was_on){
+                ++pot.pump_cycles;
+                ++counters.pump_cycles;
+            }
+        }
+        pot.pump_was_on = on;
+        double soaked_ml = pot.water_in_transit_ml * (1 - exp(-seconds / config.soak_time_s));
+        pot.water_in_transit_ml -= soaked_ml;
+        pot.soil_moisture += soaked_ml * 100 / config.pot_ml;
+        if(pot.soil_moisture > config.field_capacity){
+            double drained = (pot.soil_moisture - config.field_capacity) * (1 - exp(-seconds / 600));
+            pot.soil_moisture -= drained;
+            counters.drained_ml += drained * config.pot_ml / 100;
+        }
+    }
+
+    // Lamp, pwm duty dims it
+    lamp_level = hal::pin_output(wiring.lamp) / 255.0;
+    counters.lamp_seconds += lamp_level * seconds;
+    bool lamp_on = lamp_level > 0;
+    if(lamp_on != lamp_was_on){
+        ++counters.lamp_switches;
+    }
+    lamp_was_on = lamp_on;
+
+    // Daylight between 6 and 20 with some clouds
+    double sun = (hour > 6 && hour < 20) ? sin(PI * (hour - 6) / 14) : 0;
+    ambient_light = clamp(sun * config.daylight_percent * (1 + 0.05 * noise(random)), 0, 100);
+    if(config.cloud_percent > 0){
+        // a new cloud cover every 5 minutes on average, reached in about a minute
+        if(uniform(random) < seconds / 300){
+            cloud_target = uniform(random);
+        }
+        cloud += (cloud_target - cloud) * (1 - exp(-seconds / 60));
+        ambient_light *= 1 - config.cloud_percent / 100 * cloud;
+    }
+
+    // Temperature follows day and lamp with a slow lag
+    double target_temperature = 21 + 4 * sin(2 * PI * (hour - 9) / 24) + config.lamp_heat * lamp_level;
+    temperature += (target_temperature - temperature) * (1 - exp(-seconds / 900));
+
+    // Soil dries faster when warm and under the lamp
+    double evaporation = config.evaporation_per_hour * (1 + 0.05 * (temperature - 20)) * (1 + 0.3 * lamp_level);
+    for (size_t i = 0; i < pots.size(); ++i)
+    {
+        Pot& pot = pots[i];
+        pot.soil_moisture = clamp(pot.soil_moisture - evaporation * (1 + 0.2 * i) * seconds / 3600, 0, 100);
+    }
+
+    // Lift motor drives the arm, speed lags behind the motor
+    int input1 = hal::pin(wiring.motor_input1).level;
+    int input2 = hal::pin(wiring.motor_input2).level;
+    int pwm = hal::pin_output(wiring.motor_pwm);
+    int direction = (input1 == HIGH && input2 == LOW) ? 1 : ((input1 == LOW && input2 == HIGH) ? -1 : 0);
+    double target_speed = 0;
+    if(direction != 0 && pwm > config.motor_dead_pwm){
+        target_speed = direction * config.motor_cm_per_s * (pwm - config.motor_dead_pwm) / (255 - config.motor_dead_pwm);
+    }
+    if(direction != 0 && pwm > 0){
+        counters.motor_seconds += seconds;
+        counters.motor_energy += pwm / 255.0 * seconds;
+        if(last_motor_direction != 0 && direction != last_motor_direction){
+            ++counters.motor_reversals;
+        }
+        last_motor_direction = direction;
+    }
+    arm_speed += (target_speed - arm_speed) * (1 - exp(-seconds / config.motor_time_constant_s));
+    lamp_height += arm_speed * seconds;
+    if(lamp_height < config.min_lamp_height || lamp_height > config.max_lamp_height){
+        lamp_height = clamp(lamp_height, config.min_lamp_height, config.max_lamp_height);
+        arm_speed = 0;
+        if(direction != 0 && pwm > 0){
+            counters.end_stop_seconds += seconds;
+        }
+    }
+
+    // Plant grows, never into the lamp
+    plant_height = fmin(plant_height + config.growth_cm_per_day * seconds / 86400, lamp_height - 2);
+}
+
+int Plant::digital_input(int pin){
+    for (const Press& button : presses)
+    {
+        if(button.pin == pin && time_s >= button.from && time_s < button.to){
+            return HIGH;
+        }
+    }
+    return LOW;
+}
+
+int Plant::analog_input(int pin){
+    double code = 0;
+    if(pin == config.unplugged_pin){
+        return 0;
+    }
+    if(uniform(random) < config.spike_chance){
+        return (int)(uniform(random) * 1024);
+    }
+    if(pin == wiring.temperature){
+        code = (500 + 10 * temperature) * 1024 / 5000; // TMP36
+    }else if(pin == wiring.light){
+        code = clamp(ambient_light + config.lamp_light_percent * lamp_level, 0, 100) * 900 / 100;
+    }else if(pin == wiring.soil){
+        size_t pot = wiring.zones == 1 ? 0 : (hal::shift_register_outputs() >> wiring.shift_select_bit) & 7;
+        if(pot >= pots.size()){
+            return 0; // multiplexer input without a sensor
+        }
+        code = pots[pot].soil_moisture * 876 / 100;
+    }
+    code += config.adc_noise * noise(random);
+    return (int)clamp(round(code), 0, 1023);
+}
+
+unsigned long Plant::echo_time(int pin){
+    if(pin != wiring.ultrasonic || pin == config.unplugged_pin || uniform(random) < config.echo_dropout){
+        return 0;
+    }
+    if(uniform(random) < config.spike_chance){
+        return (unsigned long)(uniform(random) * 400 / 0.01723);
+    }
+    double cm = (config.echo_object_cm > 0 ? config.echo_object_cm : distance()) + config.echo_noise_cm * noise(random);
+    return (unsigned long)(fmax(cm, 2) / 0.01723);
+}
@@ -0,0 +1,128 @@
+/*
+Plant model for the host simulation: pots with soil that dries and is watered by their pump,
+daylight and the grow lamp, a lamp arm moved by the lift motor and a plant that grows towards it.
+Actuators are read from the pins the sketch drives, sensors answer through SimWorld.
+*/
+#pragma once
+
+#include "hal.h"
+
+#include <random>
+#include <vector>
+
+/* Pins of the sketch the plant is wired to */
+struct PlantWiring {
+    int pump;
+    int lamp;
+    int motor_input1; // HIGH with input2 LOW lifts the arm
+    int motor_input2;
+    int motor_pwm;
+    int ultrasonic;
+    int temperature;
+    int light;
+    int soil;
+    int zones = 1; // pots, each with a soil sensor and a pump
+    int shift_select_bit = -1; // with more than one pot the soil multiplexer select S0 is this shift register output
+    int shift_pump_bit = -1; // and the pump of pot 0 this one, the other pumps follow
+};
+
+/* Starting state and physical constants */
+struct PlantConfig {
+    double start_hour = 8; // time of day when simulation starts
+    double soil_moisture = 55; // percent at the sensor
+    double lamp_height = 90; // cm above the pot
+    double plant_height = 30; // cm
+    double evaporation_per_hour = 1.2; // percent of soil moisture at 20 Celsius, each further pot 20% more
+    double pot_ml = 1000; // water that takes soil from 0 to 100 percent
+    double field_capacity = 80; // percent, water above it drains out of the pot
+    double pump_ml_per_s = 20;
+    double soak_time_s = 60; // time constant of water reaching the sensor
+    double motor_cm_per_s = 3; // arm speed at full pwm
+    double motor_dead_pwm = 40; // arm does not move below this duty
+    double motor_time_constant_s = 0.3; // arm speed follows motor with this lag
+    double min_lamp_height = 10; // end stops of the arm
+    double max_lamp_height = 160;
+    double growth_cm_per_day = 0.5;
+    double daylight_percent = 85; // light sensor at noon
+    double lamp_light_percent = 25; // light sensor increase with lamp fully on
+    double lamp_heat = 2; // Celsius the lamp adds at the sensor
+    double lamp_watts = 15; // at full duty
+    double cloud_percent = 0; // most of the daylight passing clouds take away, they change over minutes
+    double echo_noise_cm = 0.5;
+    double echo_dropout = 0.01; // chance that a ping gets no echo
+    double echo_object_cm = 0; // echoes come from something this far from the sensor instead of the plant, 0 for none
+    double adc_noise = 2; // codes
+    double spike_chance = 0; // chance that a sensor sample is garbage anywhere in its range
+    int unplugged_pin = -1; // sensor that reads 0 or gives no echo
+    unsigned seed = 1;
+};
+
+/* Soil of one pot */
+struct Pot {
+    double soil_moisture; // percent at the sensor
+    double water_in_transit_ml = 0; // pumped water not yet at the sensor
+    double water_ml = 0;
+    unsigned long pump_cycles = 0;
+    bool pump_was_on = false;
+};
+
+/* Totals over a run */
+struct PlantCounters {
+    double water_ml = 0;
+    double drained_ml = 0; // water above field capacity, lost
+    unsigned long pump_cycles = 0;
+    double pump_seconds = 0;
+    double lamp_seconds = 0; // full on equivalent
+    unsigned long lamp_switches = 0;
+    double motor_seconds = 0;
+    double motor_energy = 0; // duty * seconds
+    unsigned long motor_reversals = 0;
+    double end_stop_seconds = 0; // motor driving against an end stop
+};
+
+class Plant : public SimWorld {
+public:
+    Plant(const PlantWiring& wiring, const PlantConfig& config);
+
+    /* Advance the physics by seconds using actuator pins as set now */
+    void step(double seconds);
+
+    /* Hold a button pin HIGH from at_s for duration_s seconds of simulated time */
+    void press(int pin, double at_s, double duration_s);
+
+    int digital_input(int pin) override;
+    int analog_input(int pin) override;
+    unsigned long echo_time(int pin) override;
+
+    double distance() const { return lamp_height - plant_height; }
+    bool pump_on(int pot) const;
+    double hour_of_day() const;
+
+    PlantWiring wiring;
+    PlantConfig config;
+    PlantCounters counters;
+
+    double time_s = 0;
+    std::vector<Pot> pots;
+    double lamp_height;
+    double plant_height;
+    double arm_speed = 0; // cm/s, positive lifts
+    double temperature = 20;
+    double lamp_level = 0; // 0-1
+    double ambient_light = 0; // percent
+    double cloud = 0; // 0-1 of cloud_percent
+
+private:
+    struct Press {
+        int pin;
+        double from;
+        double to;
+    };
+    std::vector<Press> presses;
+    std::mt19937 random;
+    std::normal_distribution<double> noise;
+    std::uniform_real_distribution<double> uniform;
+    double cloud_target = 0;
+    bool lamp_was_on = false;
+    int last_motor_direction = 0;
+};
@@ -0,0 +1,117 @@
+/*
+Checks the integer sensor scales of kod.cpp against the float formulas they replaced, for every ADC code.
+
+usage: scale_check
+
+Every code goes through convert() of the scales of the sketch and through the float formulas the
+sketch had before the scales, in float since double is float on the board:
+round((code * 5.0 / 1024 - 0.5) * 100) for the temperature and code / FULL_SCALE * 100 truncated
+for light and soil. Light differs on codes 477, 531, 945 and 954, exact multiples where float
+rounding gave one less (477 / 900 * 100 came out as 52.99), those are expected. The soil tenths of
+convert_tenths() had no float formula, they are checked against code * 1000 / FULL_SCALE.
+The host has a 64 bit long, the board a 32 bit one, so the factors are checked on their own: the
+product of the highest code and FACTOR, TENTHS_FACTOR or SLOPE has to fit 32 bits.
+
+Prints NAME_mismatches and NAME_overflow per scale and a NAME_code=CODE,REFERENCE,SKETCH line for
+every code that differs, and exits with 1 on an overflow or a difference that is not expected.
+*/
+#include "Arduino.h"
+#include "../kod.cpp"
+
+#include <initializer_list>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace {
+
+const int EXPECTED_LIGHT_CODES[] = {477, 531, 945, 954};
+
+/* Results of one scale over all codes */
+struct ScaleCheck {
+    const char* name;
+    int mismatches = 0;
+    int unexpected = 0;
+    bool overflow = false; // a product does not fit the 32 bit long of the board
+};
+
+bool expected_light_code(int code){
+    for (int expected : EXPECTED_LIGHT_CODES)
+    {
+        if(code == expected){
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Float formula of the old read_temperature(), all in float since double is float on the board */
+int float_temperature(int code){
+    float reading = code;
+    float voltage = reading * (float)(5.0 / 1024.0);
+    return roundf((voltage - 0.5f) * 100.0f);
+}
+
+/* Float formula of the old read_light_intensity() and read_soil_moisture(), all in float */
+int float_percent(int code, int full_scale){
+    float reading = code;
+    return (reading / full_scale) * 100.0f;
+}
+
+/* true when the highest code times factor does not fit limit, the long of the board */
+bool overflows(uint64_t factor, uint64_t limit){
+    return (uint64_t)(ADC_CODES - 1) * factor > limit;
+}
+
+/* Count and print a code where the sketch gives another value than the reference */
+void compare(ScaleCheck& check, int code, int reference, int sketch, bool expected){
+    if(reference == sketch){
+        return;
+    }
+    ++check.mismatches;
+    if(!expected){
+        ++check.unexpected;
+    }
+    printf("%s_code=%d,%d,%d\n", check.name, code, reference, sketch);
+}
+
+void report(const ScaleCheck& check){
+    printf("%s_mismatches=%d\n", check.name, check.mismatches);
+    printf("%s_overflow=%d\n", check.name, check.overflow ? 1 : 0);
+}
+
+}
+
+int main(int argc, char**){
+    if(argc != 1){
+        fprintf(stderr, "usage: scale_check\n");
+        return 2;
+    }
+    ScaleCheck temperature, light, soil, soil_tenths;
+    temperature.name = "temperature";
+    light.name = "light";
+    soil.name = "soil";
+    soil_tenths.name = "soil_tenths";
+    temperature.overflow = overflows(TemperatureSensorScale::SLOPE, INT32_MAX)
+        || (uint64_t)TemperatureSensorScale::OFFSET > INT32_MAX;
+    light.overflow = overflows(LightSensorScale::FACTOR, UINT32_MAX);
+    soil.overflow = overflows(SoilSensorScale::FACTOR, UINT32_MAX);
+    soil_tenths.overflow = overflows(SoilSensorScale::TENTHS_FACTOR, UINT32_MAX);
+    for (int code = 0; code < ADC_CODES; ++code)
+    {
+        compare(temperature, code, float_temperature(code), TemperatureSensorScale::convert(code), false);
+        compare(light, code, float_percent(code, Board::LIGHT_FULL_SCALE), LightSensorScale::convert(code),
+                expected_light_code(code));
+        compare(soil, code, float_percent(code, Board::SOIL_FULL_SCALE), SoilSensorScale::convert(code), false);
+        compare(soil_tenths, code, (int)((uint64_t)code * 1000 / Board::SOIL_FULL_SCALE), SoilSensorScale::convert_tenths(code),
+                false);
+    }
+    bool failed = false;
+    for (const ScaleCheck& check : {temperature, light, soil, soil_tenths})
+    {
+        report(check);
+        failed = failed || check.unexpected > 0 || check.overflow;
+    }
+    printf("result=%s\n", failed ? "FAIL" : "OK");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,602 @@
+/*
+Runs kod.cpp against the plant model on a virtual clock.
+
+usage: plant_sim [--hours H] [--seed N] [--trace MINUTES] [--press PIN,AT_S,DURATION_S] [--serial AT_S,TEXT]
+                 [--gap AT_S,CM] [--spikes CHANCE] [--unplug PIN] [--plant NAME=VALUE] [--serial-out FILE]
+                 [--actuators FILE] [--setpoint NAME=VALUE] [--fault KIND,AT_S[,VALUE]]
+
+Prints a summary of actuator use, time out of the setpoint bands, how long loop()
+takes on this machine, and the share of time the board would be awake instead of asleep
+with the current it draws. --trace adds a CSV line of sensors and actuators every MINUTES.
+--gap changes distance_gap at AT_S and reports how the lamp arm settles on the new gap.
+--spikes makes that share of sensor samples garbage, --unplug disconnects a sensor.
+--plant sets a field of PlantConfig, for example --plant soak_time_s=600.
+--setpoint sets a setpoint of the sketch by its serial command name, for example --setpoint soil=40,
+a per zone setpoint for every zone. host/fleet sweeps these over many runs.
+--serial-out writes what the sketch sends over serial to FILE instead of stdout.
+--fault injects a fault at AT_S to see the safety supervisor handle it: hang makes the distance task
+hang for VALUE seconds (3), pump opens the pump of zone 0 behind the back of the watering logic and echo
+makes the echo come from something VALUE cm (5) in front of the sensor, so the arm chases a gap it never
+reaches. The simulation plays the watchdog, its interrupt comes SAFETY_WATCHDOG_TIME after the last
+feed and the reset as long again later, which ends the run. The plant does not move during a hang and
+sees the outputs as they are after it. The summary gives the longest time a pump and the lift motor
+were on at once and the fault log.
+--actuators writes every change of an output to FILE, see actuators.h. With a build
+with RECORDING=1 host/trace_replay replays the serial output and should write the same.
+Built with ZONE_COUNT above 1 every zone waters its own pot, the summary then adds
+per zone totals and zone_cycle_ms, the time the soil multiplexer takes to visit all zones.
+*/
+#include "Arduino.h"
+#include "../kod.cpp"
+
+#include "actuators.h"
+#include "hal.h"
+#include "plant.h"
+#include "sketch_actuators.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+const uint64_t LOOP_STEP_US = 1000; // virtual time between loop() passes, they start on a multiple of it
+const uint64_t PLANT_STEP_US = 10000;
+const double GAP_SETTLE_CM = 3; // arm counts as settled within this of distance_gap
+
+/* Change of distance_gap at a given time */
+struct GapStep {
+    uint64_t at_us;
+    int gap;
+};
+
+/* Step response of the lamp arm to a gap change */
+struct GapResponse {
+    double start_s = 0;
+    double direction = 0; // 1 when the gap grew
+    double overshoot_cm = 0; // furthest past the new gap in the direction of travel
+    double settled_s = -1; // last time the arm entered the settle band
+    double energy_start = 0; // motor energy counter at the step
+};
+
+/* Text the sketch receives over serial at a given time */
+struct SerialInput {
+    uint64_t at_us;
+    std::string text;
+};
+
+/* Text the sketch prints for the summary, straight to stdout */
+class StdoutPrint : public Print {
+public:
+    size_t write(uint8_t c) override {
+        return putchar(c) == EOF ? 0 : 1;
+    }
+};
+
+StdoutPrint stdout_print;
+
+/* Fault injected at a given time, see --fault */
+struct Fault {
+    std::string kind;
+    uint64_t at_us;
+    double value;
+};
+
+/* The watchdog of the board, fed through safety_fed_time */
+struct Watchdog {
+    bool interrupted = false; // the interrupt came, the next timeout resets
+    unsigned long interrupt_feed = 0; // safety_fed_time when it came
+    unsigned long interrupts = 0;
+    double reset_s = -1;
+};
+
+Watchdog watchdog;
+void (*hung_task)() = 0; // task the hanging one stands in for
+uint64_t hang_at_us = UINT64_MAX;
+uint64_t hang_us = 0;
+
+/* Interrupt SAFETY_WATCHDOG_TIME after the last feed and reset as long after the interrupt */
+void check_watchdog(){
+    unsigned long since_feed = millis() - safety_fed_time;
+    if(watchdog.interrupted && safety_fed_time != watchdog.interrupt_feed){
+        watchdog.interrupted = false; // fed in time, the feed arms the interrupt again
+    }
+    if(!watchdog.interrupted && since_feed >= SAFETY_WATCHDOG_TIME){
+        watchdog.interrupted = true;
+        watchdog.interrupt_feed = safety_fed_time;
+        ++watchdog.interrupts;
+        safety_watchdog();
+    }else if(watchdog.interrupted && since_feed >= 2 * SAFETY_WATCHDOG_TIME && watchdog.reset_s < 0){
+        watchdog.reset_s = hal::now_us() / 1e6;
+        safety_reset_flags = SAFETY_WATCHDOG_RESET;
+        safety_start(); // what setup() does of it after the reset
+    }
+}
+
+/* Runs the task it stands in for and hangs in it once after hang_at_us, the clock goes on */
+void hanging_task(){
+    hung_task();
+    if(hal::now_us() < hang_at_us){
+        return;
+    }
+    uint64_t end_us = hal::now_us() + hang_us;
+    hang_at_us = UINT64_MAX;
+    while(hal::now_us() < end_us && watchdog.reset_s < 0){
+        hal::advance_us(1000);
+        check_watchdog();
+    }
+}
+
+struct Options {
+    double hours = 24;
+    unsigned seed = 1;
+    double trace_minutes = 0;
+};
+
+/* Pins of kod.cpp */
+PlantWiring sketch_wiring(){
+    PlantWiring wiring;
+    wiring.pump = DC_PUMP_PIN;
+    wiring.lamp = LAMP_PIN;
+    wiring.motor_input1 = DC_INPUT1_PIN;
+    wiring.motor_input2 = DC_INPUT2_PIN;
+    wiring.motor_pwm = DC_PWM;
+    wiring.ultrasonic = ULTRASONIC_PIN;
+    wiring.temperature = TEMPERATURE_PIN;
+    wiring.light = LIGHT_SENSOR_PIN;
+    wiring.soil = SOIL_MOISTURE_PIN;
+    wiring.zones = ZONE_COUNT;
+    if(ZONE_COUNT > 1){
+        wiring.shift_select_bit = SHIFT_SELECT_BIT;
+        wiring.shift_pump_bit = SHIFT_PUMP_BIT;
+    }
+    return wiring;
+}
+
+/* Set a PlantConfig field from NAME=VALUE, false when there is no such field */
+bool set_plant_config(PlantConfig& config, const char* assignment){
+    static const struct {
+        const char* name;
+        double PlantConfig::*field;
+    } FIELDS[] = {
+        {"start_hour", &PlantConfig::start_hour},
+        {"soil_moisture", &PlantConfig::soil_moisture},
+        {"lamp_height", &PlantConfig::lamp_height},
+        {"plant_height", &PlantConfig::plant_height},
+        {"evaporation_per_hour", &PlantConfig::evaporation_per_hour},
+        {"pot_ml", &PlantConfig::pot_ml},
+        {"field_capacity", &PlantConfig::field_capacity},
+        {"pump_ml_per_s", &PlantConfig::pump_ml_per_s},
+        {"soak_time_s", &PlantConfig::soak_time_s},
+        {"motor_cm_per_s", &PlantConfig::motor_cm_per_s},
+        {"motor_dead_pwm", &PlantConfig::motor_dead_pwm},
+        {"motor_time_constant_s", &PlantConfig::motor_time_constant_s},
+        {"min_lamp_height", &PlantConfig::min_lamp_height},
+        {"max_lamp_height", &PlantConfig::max_lamp_height},
+        {"growth_cm_per_day", &PlantConfig::growth_cm_per_day},
+        {"daylight_percent", &PlantConfig::daylight_percent},
+        {"lamp_light_percent", &PlantConfig::lamp_light_percent},
+        {"lamp_heat", &PlantConfig::lamp_heat},
+        {"lamp_watts", &PlantConfig::lamp_watts},
+        {"cloud_percent", &PlantConfig::cloud_percent},
+        {"echo_noise_cm", &PlantConfig::echo_noise_cm},
+        {"echo_dropout", &PlantConfig::echo_dropout},
+        {"echo_object_cm", &PlantConfig::echo_object_cm},
+        {"adc_noise", &PlantConfig::adc_noise},
+        {"spike_chance", &PlantConfig::spike_chance},
+    };
+    const char* value = strchr(assignment, '=');
+    if(value == 0){
+        return false;
+    }
+    for (const auto& field : FIELDS)
+    {
+        if(strncmp(field.name, assignment, value - assignment) == 0 && field.name[value - assignment] == 0){
+            config.*field.field = atof(value + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Set a setpoint of the sketch from NAME=VALUE after setup(), false when there is no such setpoint */
+bool set_sketch_setpoint(const char* assignment){
+    const char* value = strchr(assignment, '=');
+    if(value == 0){
+        return false;
+    }
+    std::string name(assignment, value - assignment);
+    for (int i = 0; i < SETPOINT_COUNT; ++i)
+    {
+        if(strcmp_P(name.c_str(), load_setpoint(i).name) != 0){
+            continue;
+        }
+        for (selected_zone = 0; selected_zone < (load_setpoint(i).per_zone ? ZONE_COUNT : 1); ++selected_zone)
+        {
+            set_setpoint(load_setpoint(i), atoi(value + 1));
+        }
+        selected_zone = 0;
+        return true;
+    }
+    return false;
+}
+
+void usage(){
+    fprintf(stderr, "usage: plant_sim [--hours H] [--seed N] [--trace MINUTES] [--press PIN,AT_S,DURATION_S] [--serial AT_S,TEXT]"
+                    " [--gap AT_S,CM] [--spikes CHANCE] [--unplug PIN] [--plant NAME=VALUE]"
+                    " [--serial-out FILE] [--actuators FILE] [--setpoint NAME=VALUE] [--fault KIND,AT_S[,VALUE]]\n");
+    exit(2);
+}
+
+}
+
+int main(int argc, char** argv){
+    Options options;
+    PlantConfig config;
+    std::vector<double> presses; // pin, at, duration
+    std::vector<SerialInput> serial_inputs;
+    std::vector<GapStep> gap_steps;
+    std::vector<const char*> setpoints; // NAME=VALUE
+    std::vector<Fault> faults;
+    FILE* serial_file = 0;
+    FILE* actuator_file = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* option = argv[i];
+        if(i + 1 >= argc){
+            usage();
+        }
+        const char* value = argv[++i];
+        if(strcmp(option, "--hours") == 0){
+            options.hours = atof(value);
+        }else if(strcmp(option, "--seed") == 0){
+            options.seed = atoi(value);
+        }else if(strcmp(option, "--trace") == 0){
+            options.trace_minutes = atof(value);
+        }else if(strcmp(option, "--press") == 0){
+            double pin, at, duration;
+            if(sscanf(value, "%lf,%lf,%lf", &pin, &at, &duration) != 3){
+                usage();
+            }
+            presses.insert(presses.end(), {pin, at, duration});
+        }else if(strcmp(option, "--serial") == 0){
+            const char* text = strchr(value, ',');
+            if(text == 0){
+                usage();
+            }
+            serial_inputs.push_back({(uint64_t)(atof(value) * 1e6), text + 1});
+        }else if(strcmp(option, "--spikes") == 0){
+            config.spike_chance = atof(value);
+        }else if(strcmp(option, "--unplug") == 0){
+            config.unplugged_pin = atoi(value);
+        }else if(strcmp(option, "--serial-out") == 0){
+            serial_file = fopen(value, "wb");
+            if(serial_file == 0){
+                perror(value);
+                return 1;
+            }
+        }else if(strcmp(option, "--actuators") == 0){
+            actuator_file = fopen(value, "w");
+            if(actuator_file == 0){
+                perror(value);
+                return 1;
+            }
+        }else if(strcmp(option, "--plant") == 0){
+            if(!set_plant_config(config, value)){
+                usage();
+            }
+        }else if(strcmp(option, "--setpoint") == 0){
+            setpoints.push_back(value);
+        }else if(strcmp(option, "--gap") == 0){
+            double at;
+            int gap;
+            if(sscanf(value, "%lf,%d", &at, &gap) != 2){
+                usage();
+            }
+            gap_steps.push_back({(uint64_t)(at * 1e6), gap});
+        }else if(strcmp(option, "--fault") == 0){
+            char kind[8];
+            double at;
+            double fault_value = 0;
+            if(sscanf(value, "%7[a-z],%lf,%lf", kind, &at, &fault_value) < 2){
+                usage();
+            }
+            if(strcmp(kind, "hang") == 0){
+                hang_at_us = (uint64_t)(at * 1e6);
+                hang_us = (uint64_t)((fault_value > 0 ? fault_value : 3) * 1e6);
+            }else if(strcmp(kind, "pump") == 0 || strcmp(kind, "echo") == 0){
+                faults.push_back({kind, (uint64_t)(at * 1e6), fault_value > 0 ? fault_value : 5});
+            }else{
+                usage();
+            }
+        }else{
+            usage();
+        }
+    }
+    config.seed = options.seed;
+
+    Plant plant(sketch_wiring(), config);
+    for (size_t i = 0; i + 2 < presses.size(); i += 3)
+    {
+        plant.press((int)presses[i], presses[i + 1], presses[i + 2]);
+    }
+    hal::attach(&plant);
+    if(ZONE_COUNT > 1){
+        hal::wire_shift_register(SHIFT_DATA_PIN, SHIFT_CLOCK_PIN, SHIFT_LATCH_PIN);
+    }
+    if(serial_file != 0){
+        hal::serial_output(serial_file);
+    }
+    setup();
+    for (Task& task : tasks)
+    {
+        if(task.run == distance_task){
+            hung_task = task.run;
+            task.run = hanging_task;
+        }
+    }
+    for (const char* setpoint : setpoints)
+    {
+        if(!set_sketch_setpoint(setpoint)){
+            usage();
+        }
+    }
+
+    const uint64_t end_us = (uint64_t)(options.hours * 3600e6);
+    const uint64_t trace_us = (uint64_t)(options.trace_minutes * 60e6);
+    uint64_t next_plant_us = PLANT_STEP_US;
+    uint64_t next_trace_us = 0;
+    double dry_seconds = 0; // soil below min_soil_moinstrure, summed over zones
+    std::vector<double> zone_dry_seconds(ZONE_COUNT);
+    int selected_sensor = 0; // soil multiplexer input
+    double zone_cycles = 0; // visits of the multiplexer to zone 0 after the first
+    uint64_t first_cycle_us = 0;
+    uint64_t last_cycle_us = 0;
+    double gap_seconds = 0; // arm more than gap_tolerance off distance_gap
+    unsigned long alerts = 0; // raises of alarms, the red led
+    unsigned long warnings = 0; // raises of warnings, the yellow led
+    double alert_seconds = 0; // an alarm raised
+    double warning_seconds = 0; // only warnings raised
+    double buzzer_seconds = 0;
+    uint8_t last_alerts = 0;
+    uint8_t warning_alerts = 0;
+    for (int alert = 0; alert < ALERT_COUNT; ++alert)
+    {
+        warning_alerts |= ALERTS[alert].warning ? 1 << alert : 0;
+    }
+    double pump_on_s = 0; // a pump has been on this long without a break
+    double motor_on_s = 0;
+    double longest_pump_s = 0;
+    double longest_motor_s = 0;
+    double soil_min = 100; // after the first hour, when the sketch had time to catch up
+    double soil_max = 0;
+    std::vector<GapResponse> gap_responses;
+    ActuatorLog actuators(sketch_actuators());
+    std::vector<std::string> actuator_lines;
+    if(actuator_file != 0){
+        fprintf(actuator_file, "%s\n", ACTUATOR_HEADER);
+    }
+    unsigned long long loops = 0;
+    double loop_max_ns = 0;
+    if(trace_us > 0){
+        printf("minute,soil,soil_sensor,temperature,light,distance,distance_sensor,pump,lamp,motor\n");
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    while(hal::now_us() < end_us){
+        auto before = std::chrono::steady_clock::now();
+        loop();
+        double loop_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - before).count();
+        if(loop_ns > loop_max_ns){
+            loop_max_ns = loop_ns;
+        }
+        ++loops;
+        check_watchdog();
+        if(watchdog.reset_s >= 0){
+            break;
+        }
+        if(actuator_file != 0){
+            actuators.sample(actuator_lines);
+            for (const std::string& line : actuator_lines)
+            {
+                fprintf(actuator_file, "%s\n", line.c_str());
+            }
+            actuator_lines.clear();
+        }
+        int sensor = (hal::shift_register_outputs() >> SHIFT_SELECT_BIT) & 7;
+        if(ZONE_COUNT > 1 && sensor == 0 && selected_sensor != 0){
+            if(first_cycle_us == 0){
+                first_cycle_us = hal::now_us();
+            }else{
+                ++zone_cycles;
+            }
+            last_cycle_us = hal::now_us();
+        }
+        selected_sensor = sensor;
+        hal::advance_us(LOOP_STEP_US - hal::now_us() % LOOP_STEP_US); // delays of the sketch stay inside the step
+        for (SerialInput& input : serial_inputs)
+        {
+            if(!input.text.empty() && hal::now_us() >= input.at_us){
+                hal::serial_input(input.text.c_str());
+                input.text.clear();
+            }
+        }
+        for (Fault& fault : faults)
+        {
+            if(fault.at_us == UINT64_MAX || hal::now_us() < fault.at_us){
+                continue;
+            }
+            if(fault.kind == "pump"){
+                set_pump(0, true); // as a bug in the watering logic would leave it
+            }else{
+                plant.config.echo_object_cm = fault.value;
+            }
+            fault.at_us = UINT64_MAX;
+        }
+        for (GapStep& step : gap_steps)
+        {
+            if(step.gap >= 0 && hal::now_us() >= step.at_us){
+                GapResponse response;
+                response.start_s = hal::now_us() / 1e6;
+                response.direction = step.gap > distance_gap ? 1 : -1;
+                response.energy_start = plant.counters.motor_energy;
+                gap_responses.push_back(response);
+                distance_gap = step.gap;
+                step.gap = -1;
+            }
+        }
+        while(hal::now_us() >= next_plant_us){
+            double seconds = PLANT_STEP_US / 1e6;
+            plant.step(seconds);
+            for (int zone = 0; zone < ZONE_COUNT; ++zone)
+            {
+                double soil = plant.pots[zone].soil_moisture;
+                if(soil < min_soil_moinstrure[zone]){
+                    dry_seconds += seconds;
+                    zone_dry_seconds[zone] += seconds;
+                }
+                if(hal::now_us() > 3600e6){
+                    soil_min = fmin(soil_min, soil);
+                    soil_max = fmax(soil_max, soil);
+                }
+            }
+            if(plant.distance() < distance_gap - gap_tolerance || plant.distance() > distance_gap + gap_tolerance){
+                gap_seconds += seconds;
+            }
+            uint8_t raised = alerts_active & ~last_alerts;
+            for (int alert = 0; alert < ALERT_COUNT; ++alert)
+            {
+                if(raised & warning_alerts & (1 << alert)){
+                    ++warnings;
+                }else if(raised & (1 << alert)){
+                    ++alerts;
+                }
+            }
+            last_alerts = alerts_active;
+            if(alerts_active & ~warning_alerts){
+                alert_seconds += seconds;
+            }else if(alerts_active){
+                warning_seconds += seconds;
+            }
+            if(hal::tone_frequency(BUZZER) > 0){
+                buzzer_seconds += seconds;
+            }
+            bool pump = false;
+            for (int zone = 0; zone < ZONE_COUNT; ++zone)
+            {
+                pump = pump || plant.pump_on(zone);
+            }
+            bool motor = hal::pin(DC_INPUT1_PIN).level != hal::pin(DC_INPUT2_PIN).level && hal::pin_output(DC_PWM) > 0;
+            pump_on_s = pump ? pump_on_s + seconds : 0;
+            motor_on_s = motor ? motor_on_s + seconds : 0;
+            longest_pump_s = fmax(longest_pump_s, pump_on_s);
+            longest_motor_s = fmax(longest_motor_s, motor_on_s);
+            if(!gap_responses.empty()){
+                GapResponse& response = gap_responses.back();
+                double past = (plant.distance() - distance_gap) * response.direction;
+                if(past > response.overshoot_cm){
+                    response.overshoot_cm = past;
+                }
+                bool inside = fabs(plant.distance() - distance_gap) <= GAP_SETTLE_CM;
+                if(!inside){
+                    response.settled_s = -1;
+                }else if(response.settled_s < 0){
+                    response.settled_s = hal::now_us() / 1e6 - response.start_s;
+                }
+            }
+            next_plant_us += PLANT_STEP_US;
+        }
+        if(trace_us > 0 && hal::now_us() >= next_trace_us){
+            printf("%.0f,%.1f,%d,%d,%d,%.1f,%d,%d,%d,%d\n", hal::now_us() / 60e6, plant.pots[0].soil_moisture,
+                current_soil_moisture[0], current_temperature, current_light_intensity, plant.distance(), current_distance,
+                plant.pump_on(0) ? 255 : 0, hal::pin_output(LAMP_PIN),
+                hal::pin(DC_INPUT1_PIN).level - hal::pin(DC_INPUT2_PIN).level);
+            next_trace_us += trace_us;
+        }
+    }
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    if(actuator_file != 0){
+        fclose(actuator_file);
+    }
+    double simulated_s = hal::now_us() / 1e6;
+
+    const PlantCounters& counters = plant.counters;
+    printf("simulated_hours=%.2f\n", simulated_s / 3600);
+    printf("zones=%d\n", ZONE_COUNT);
+    printf("wall_seconds=%.3f\n", wall_s);
+    printf("speedup=%.0f\n", simulated_s / wall_s);
+    printf("loop_passes=%llu\n", loops);
+    printf("loop_mean_ns=%.0f\n", wall_s * 1e9 / loops);
+    printf("loop_max_ns=%.0f\n", loop_max_ns);
+    printf("water_ml=%.1f\n", counters.water_ml);
+    printf("drained_ml=%.1f\n", counters.drained_ml);
+    printf("pump_cycles=%lu\n", counters.pump_cycles);
+    printf("lamp_hours=%.2f\n", counters.lamp_seconds / 3600);
+    printf("lamp_switches=%lu\n", counters.lamp_switches);
+    printf("lamp_switches_per_day=%.1f\n", counters.lamp_switches * 86400 / simulated_s);
+    printf("lamp_energy_wh=%.1f\n", counters.lamp_seconds / 3600 * plant.config.lamp_watts);
+    printf("motor_seconds=%.1f\n", counters.motor_seconds);
+    printf("motor_energy=%.1f\n", counters.motor_energy);
+    printf("motor_reversals=%lu\n", counters.motor_reversals);
+    printf("end_stop_seconds=%.1f\n", counters.end_stop_seconds);
+    printf("dry_minutes=%.1f\n", dry_seconds / 60);
+    printf("gap_error_minutes=%.1f\n", gap_seconds / 60);
+    printf("alerts=%lu\n", alerts);
+    printf("alert_minutes=%.1f\n", alert_seconds / 60);
+    printf("warnings=%lu\n", warnings);
+    printf("warning_minutes=%.1f\n", warning_seconds / 60);
+    printf("buzzer_minutes=%.1f\n", buzzer_seconds / 60);
+    printf("longest_pump_s=%.1f\n", longest_pump_s);
+    printf("longest_motor_s=%.1f\n", longest_motor_s);
+    printf("watchdog_interrupts=%lu\n", watchdog.interrupts);
+    printf("watchdog_reset_s=%.1f\n", watchdog.reset_s);
+    printf("safety_faults=%lu\n", safety_faults);
+    SafetyFault fault;
+    for (int entry = 0; safety_fault(entry, fault); ++entry)
+    {
+        printf("fault_%d=", entry);
+        safety_print_fault(stdout_print, fault);
+        printf("\n");
+    }
+    printf("serial_tx_bytes=%lu\n", hal::serial_tx_bytes());
+    printf("serial_blocked_writes=%lu\n", hal::serial_blocked_writes());
+    printf("eeprom_writes=%lu\n", hal::eeprom_writes());
+    printf("awake_percent=%.1f\n", awake_permille() / 10.0);
+    printf("backlight_percent=%.1f\n", backlight_permille() / 10.0);
+    printf("current_ma=%.2f\n", estimated_current_ua() / 1000.0);
+    printf("soil_moisture=%.1f\n", plant.pots[0].soil_moisture);
+    printf("soil_min=%.1f\n", soil_min);
+    printf("soil_max=%.1f\n", soil_max);
+    printf("distance=%.1f\n", plant.distance());
+    if(ZONE_COUNT > 1){
+        printf("zone_cycle_ms=%.1f\n", zone_cycles > 0 ? (last_cycle_us - first_cycle_us) / zone_cycles / 1e3 : 0);
+        for (int zone = 0; zone < ZONE_COUNT; ++zone)
+        {
+            const Pot& pot = plant.pots[zone];
+            printf("zone_%d_pump_cycles=%lu\n", zone, pot.pump_cycles);
+            printf("zone_%d_water_ml=%.1f\n", zone, pot.water_ml);
+            printf("zone_%d_dry_minutes=%.1f\n", zone, zone_dry_seconds[zone] / 60);
+            printf("zone_%d_soil_moisture=%.1f\n", zone, pot.soil_moisture);
+        }
+    }
+    for (size_t i = 0; i < gap_responses.size(); ++i)
+    {
+        const GapResponse& response = gap_responses[i];
+        double energy = (i + 1 < gap_responses.size() ? gap_responses[i + 1].energy_start : counters.motor_energy)
+            - response.energy_start;
+        printf("gap_step_%zu_settle_s=%.1f\n", i, response.settled_s);
+        printf("gap_step_%zu_overshoot_cm=%.1f\n", i, response.overshoot_cm);
+        printf("gap_step_%zu_motor_energy=%.1f\n", i, energy);
+    }
+    for (int i = 0; i < TASK_COUNT; ++i)
+    {
+        if(tasks[i].missed > 0){
+            printf("task_%d_missed=%u\n", i, tasks[i].missed);
+        }
+    }
+    return 0;
+}
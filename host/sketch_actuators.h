@@ -0,0 +1,25 @@
+/*
+Actuators of kod.cpp, for programs that compile the sketch in. Include after ../kod.cpp.
+*/
+#pragma once
+
+#include "actuators.h"
+
+inline ActuatorWiring sketch_actuators(){
+    ActuatorWiring wiring;
+    wiring.zones = ZONE_COUNT;
+    wiring.pump = DC_PUMP_PIN;
+    wiring.lamp = LAMP_PIN;
+    wiring.motor_input1 = DC_INPUT1_PIN;
+    wiring.motor_input2 = DC_INPUT2_PIN;
+    wiring.motor_pwm = DC_PWM;
+    wiring.buzzer = BUZZER;
+    wiring.red = RED_RGB_PIN;
+    wiring.green = GREEN_RGB_PIN;
+    wiring.blue = BLUE_RGB_PIN;
+    if(ZONE_COUNT > 1){
+        wiring.shift_pump_bit = SHIFT_PUMP_BIT;
+        wiring.shift_red_bit = SHIFT_RED_BIT;
+    }
+    return wiring;
+}
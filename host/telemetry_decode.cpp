@@ -0,0 +1,111 @@
+/*
+Turns the telemetry stream of kod.cpp (built with TELEMETRY=1) into CSV, one line per record.
+
+usage: telemetry_decode [FILE]
+
+Reads the serial bytes from FILE or stdin. Frames that fail COBS decoding, the CRC or
+the layout are skipped, so text on the same port or a cut frame only costs that frame.
+Counts of frames, bad frames, dropped records and missing sequence numbers go to stderr.
+*/
+#include "frames.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+namespace {
+
+const int VERSION = 2;
+const int FIELDS = 7;
+const char* const HEADER = "time_ms,distance,temperature,light,soil,lift_pwm,pump,lamp,alerts";
+
+struct Totals {
+    unsigned long frames = 0;
+    unsigned long bad_frames = 0;
+    unsigned long records = 0;
+    unsigned long dropped_records = 0;
+    unsigned long missing_frames = 0; // gaps in the sequence number
+};
+
+/* Print the records of one frame, false when the frame is bad */
+bool decode_frame(const std::vector<uint8_t>& frame, Totals& totals, int& last_sequence){
+    std::vector<uint8_t> payload;
+    if(!frames::frame_payload(frame, payload)){
+        return false;
+    }
+    frames::Reader reader = {payload, 0, true};
+    if(reader.byte() != VERSION){
+        return false;
+    }
+    int sequence = reader.byte();
+    unsigned long time = reader.varint();
+    unsigned long interval = reader.varint();
+    unsigned long dropped = reader.varint();
+    int count = reader.byte();
+    std::vector<long> records;
+    long fields[FIELDS] = {0};
+    for (int record = 0; record < count && reader.ok; ++record)
+    {
+        if(record == 0){
+            for (long& field : fields)
+            {
+                field = reader.zigzag();
+            }
+        }else{
+            uint8_t changes = reader.byte();
+            for (int i = 0; i < FIELDS; ++i)
+            {
+                if(changes & (1 << i)){
+                    fields[i] += reader.zigzag();
+                }
+            }
+        }
+        records.insert(records.end(), fields, fields + FIELDS);
+    }
+    if(!reader.ok || !reader.done()){
+        return false;
+    }
+
+    if(last_sequence >= 0){
+        totals.missing_frames += (sequence - last_sequence - 1) & 0xFF;
+    }
+    last_sequence = sequence;
+    totals.dropped_records += dropped;
+    totals.records += count;
+    for (int record = 0; record < count; ++record)
+    {
+        const long* field = &records[record * FIELDS];
+        printf("%lu,%ld,%ld,%ld,%ld,%ld,%d,%d,%ld\n", time + record * interval, field[0], field[1], field[2], field[3],
+            field[4], (int)(field[5] & 1), (int)(field[5] >> 1 & 1), field[6]);
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char** argv){
+    FILE* input = stdin;
+    if(argc > 2){
+        fprintf(stderr, "usage: telemetry_decode [FILE]\n");
+        return 2;
+    }
+    if(argc == 2 && (input = fopen(argv[1], "rb")) == 0){
+        perror(argv[1]);
+        return 1;
+    }
+
+    printf("%s\n", HEADER);
+    Totals totals;
+    int last_sequence = -1;
+    std::vector<uint8_t> frame;
+    while(frames::read_frame(input, frame)){
+        ++totals.frames;
+        if(!decode_frame(frame, totals, last_sequence)){
+            ++totals.bad_frames;
+        }
+    }
+    fprintf(stderr, "frames=%lu\nbad_frames=%lu\nrecords=%lu\ndropped_records=%lu\nmissing_frames=%lu\n",
+        totals.frames, totals.bad_frames, totals.records, totals.dropped_records, totals.missing_frames);
+    return 0;
+}
@@ -0,0 +1,281 @@
+/*
+Replays a trace recorded by kod.cpp (built with RECORDING=1) through the control logic of this build.
+
+usage: trace_replay [--actuators FILE] [--expect FILE] TRACE
+
+TRACE holds the serial bytes of the board, frames that fail COBS decoding or the CRC are skipped.
+The sensor and button tasks are switched off and every recorded input is set at the millis() it
+changed on the board, all other tasks run unchanged on their schedule. The virtual clock jumps
+from one due task to the next, so hours of trace replay in a second or two.
+
+--actuators writes the actuator stream, see actuators.h. --expect compares the stream with one
+written before, by another build or by plant_sim --actuators on the run that made the trace,
+prints the first differences and exits with 1 when there are any. The summary adds the mean
+time of every task run on this machine, for the same trace it only changes with the code.
+*/
+#include "Arduino.h"
+#include "../kod.cpp"
+
+#include "actuators.h"
+#include "frames.h"
+#include "hal.h"
+#include "sketch_actuators.h"
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+const int VERSION = 3;
+const int DIFFERENCES_SHOWN = 5;
+
+/* Input as it changed on the board */
+struct Event {
+    unsigned long long time_ms;
+    int input;
+    int value;
+};
+
+struct Totals {
+    unsigned long frames = 0;
+    unsigned long bad_frames = 0;
+    unsigned long missing_frames = 0; // gaps in the sequence number
+    unsigned long late_events = 0; // inputs the board recorded later than they changed
+    unsigned long differences = 0;
+};
+
+/* Add the events of one frame, false when the frame is bad */
+bool decode_frame(const std::vector<uint8_t>& frame, std::vector<Event>& events, Totals& totals, int& last_sequence){
+    std::vector<uint8_t> payload;
+    if(!frames::frame_payload(frame, payload)){
+        return false;
+    }
+    frames::Reader reader = {payload, 0, true};
+    if(reader.byte() != VERSION){
+        return false;
+    }
+    int sequence = reader.byte();
+    int zones = reader.byte();
+    unsigned long late = reader.varint();
+    unsigned long long time = reader.varint();
+    std::vector<Event> frame_events;
+    while(reader.ok && !reader.done()){
+        time += reader.varint();
+        int input = reader.byte();
+        int value = reader.zigzag();
+        frame_events.push_back({time, input, value});
+    }
+    if(!reader.ok){
+        return false;
+    }
+    if(zones != ZONE_COUNT){
+        fprintf(stderr, "trace has %d zones, this build %d, build with SKETCH_OPTIONS=-DZONE_COUNT=%d\n", zones, ZONE_COUNT,
+            zones);
+        exit(1);
+    }
+    if(last_sequence >= 0){
+        totals.missing_frames += (sequence - last_sequence - 1) & 0xFF;
+    }
+    last_sequence = sequence;
+    totals.late_events += late;
+    events.insert(events.end(), frame_events.begin(), frame_events.end());
+    return true;
+}
+
+bool is_input_task(void (*run)()){
+    return run == adc_task || run == sense_task || run == distance_task || run == button_task || run == record_task;
+}
+
+void skip_task(){
+}
+
+// Run time of every task, the wrappers call the task they replaced in tasks
+void (*task_runs[TASK_COUNT])();
+double task_ns[TASK_COUNT];
+unsigned long task_calls[TASK_COUNT];
+
+template <int I>
+void timed_task(){
+    auto before = std::chrono::steady_clock::now();
+    task_runs[I]();
+    task_ns[I] += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - before).count();
+    ++task_calls[I];
+}
+
+template <size_t... I>
+void time_tasks(std::index_sequence<I...>){
+    ((task_runs[I] = is_input_task(tasks[I].run) ? skip_task : tasks[I].run, tasks[I].run = timed_task<I>), ...);
+}
+
+/* Lines of a file without their line ends */
+bool read_lines(const char* path, std::vector<std::string>& lines){
+    FILE* file = fopen(path, "r");
+    if(file == 0){
+        perror(path);
+        return false;
+    }
+    char line[256];
+    while(fgets(line, sizeof(line), file) != 0){
+        line[strcspn(line, "\r\n")] = 0;
+        lines.push_back(line);
+    }
+    fclose(file);
+    return true;
+}
+
+void usage(){
+    fprintf(stderr, "usage: trace_replay [--actuators FILE] [--expect FILE] TRACE\n");
+    exit(2);
+}
+
+}
+
+int main(int argc, char** argv){
+    const char* trace_path = 0;
+    FILE* actuator_file = 0;
+    std::vector<std::string> expected;
+    bool expecting = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* option = argv[i];
+        if(option[0] != '-' && trace_path == 0){
+            trace_path = option;
+            continue;
+        }
+        if(i + 1 >= argc){
+            usage();
+        }
+        const char* value = argv[++i];
+        if(strcmp(option, "--actuators") == 0){
+            actuator_file = fopen(value, "w");
+            if(actuator_file == 0){
+                perror(value);
+                return 1;
+            }
+        }else if(strcmp(option, "--expect") == 0){
+            if(!read_lines(value, expected)){
+                return 1;
+            }
+            expecting = true;
+        }else{
+            usage();
+        }
+    }
+    if(trace_path == 0){
+        usage();
+    }
+    FILE* trace = fopen(trace_path, "rb");
+    if(trace == 0){
+        perror(trace_path);
+        return 1;
+    }
+
+    Totals totals;
+    std::vector<Event> events;
+    std::vector<uint8_t> frame;
+    int last_sequence = -1;
+    while(frames::read_frame(trace, frame)){
+        ++totals.frames;
+        if(!decode_frame(frame, events, totals, last_sequence)){
+            ++totals.bad_frames;
+        }
+    }
+    fclose(trace);
+    if(events.empty()){
+        fprintf(stderr, "%s: no recorded inputs\n", trace_path);
+        return 1;
+    }
+
+    // start where the trace starts, tasks on the grid they had on the board
+    hal::serial_output(0);
+    if(ZONE_COUNT > 1){
+        hal::wire_shift_register(SHIFT_DATA_PIN, SHIFT_CLOCK_PIN, SHIFT_LATCH_PIN);
+    }
+    const unsigned long long start_ms = events.front().time_ms;
+    const unsigned long long end_ms = events.back().time_ms;
+    hal::advance_us(start_ms * 1000);
+    setup();
+    time_tasks(std::make_index_sequence<TASK_COUNT>());
+    for (Task& task : tasks)
+    {
+        task.last_run = start_ms - start_ms % task.period;
+    }
+
+    ActuatorLog actuators(sketch_actuators());
+    std::vector<std::string> lines = {ACTUATOR_HEADER};
+    size_t line_count = 0; // lines compared or written so far
+    size_t next_event = 0;
+    unsigned long long loops = 0;
+    auto started = std::chrono::steady_clock::now();
+    while(true){
+        unsigned long long now = millis();
+        while(next_event < events.size() && events[next_event].time_ms <= now){
+            record_apply(events[next_event].input, events[next_event].value);
+            ++next_event;
+        }
+        loop();
+        ++loops;
+        actuators.sample(lines);
+        for (const std::string& line : lines)
+        {
+            if(actuator_file != 0){
+                fprintf(actuator_file, "%s\n", line.c_str());
+            }
+            if(expecting && (line_count >= expected.size() || expected[line_count] != line)){
+                if(++totals.differences <= DIFFERENCES_SHOWN){
+                    printf("line %zu: expected %s, replay %s\n", line_count + 1,
+                        line_count < expected.size() ? expected[line_count].c_str() : "nothing", line.c_str());
+                }
+            }
+            ++line_count;
+        }
+        lines.clear();
+        if(now >= end_ms){
+            break;
+        }
+        // sleep to the next due task, recorded input or end of a timed tone
+        unsigned long long next = next_event < events.size() ? events[next_event].time_ms : end_ms;
+        for (const Task& task : tasks)
+        {
+            next = std::min<unsigned long long>(next, task.last_run + task.period);
+        }
+        uint64_t tone_stop = hal::tone_stop_us(BUZZER);
+        if(tone_stop != 0){
+            next = std::min<unsigned long long>(next, (tone_stop + 999) / 1000);
+        }
+        hal::advance_us((std::max(next, now + 1) - now) * 1000);
+    }
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    if(actuator_file != 0){
+        fclose(actuator_file);
+    }
+    if(expecting && line_count < expected.size()){
+        totals.differences += expected.size() - line_count;
+        printf("line %zu: expected %s, replay ended\n", line_count + 1, expected[line_count].c_str());
+    }
+
+    printf("frames=%lu\n", totals.frames);
+    printf("bad_frames=%lu\n", totals.bad_frames);
+    printf("missing_frames=%lu\n", totals.missing_frames);
+    printf("late_events=%lu\n", totals.late_events);
+    printf("events=%zu\n", events.size());
+    printf("replayed_hours=%.2f\n", (end_ms - start_ms) / 3600e3);
+    printf("wall_seconds=%.3f\n", wall_s);
+    printf("speedup=%.0f\n", (end_ms - start_ms) / 1e3 / wall_s);
+    printf("loop_passes=%llu\n", loops);
+    printf("loop_mean_ns=%.0f\n", wall_s * 1e9 / loops);
+    for (int i = 0; i < TASK_COUNT; ++i)
+    {
+        if(task_calls[i] > 0 && task_runs[i] != skip_task){
+            printf("task_%s_ns=%.0f\n", tasks[i].name, task_ns[i] / task_calls[i]);
+        }
+    }
+    printf("actuator_changes=%lu\n", actuators.changes);
+    if(expecting){
+        printf("differences=%lu\n", totals.differences);
+    }
+    return totals.differences > 0 ? 1 : 0;
+}
@@ -1,48 +1,289 @@
 #include <Adafruit_LiquidCrystal.h>
+#include <EEPROM.h>
+#if defined(__AVR__)
+#include <avr/power.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#endif
+
+// Build options, 1 to enable, can also be given on the compiler command line
+// Time loop() and every task, the serial commands stats and reset dump them and start them again
+#ifndef INSTRUMENTATION
+#define INSTRUMENTATION 0
+#endif
+
+// Water with the old fixed 400ms pulse every 2s while soil is dry, kept to compare the watering engine with
+#ifndef PULSE_WATERING
+#define PULSE_WATERING 0
+#endif
+
+// Stream sensors, actuators and alerts over serial as binary frames, see host/telemetry_decode.cpp
+#ifndef TELEMETRY
+#define TELEMETRY 0
+#endif
+
+// Read and write setpoints with text commands over serial, see command_task(). On by default with
+// any other use of the serial port, its menu command stands in for the menu button on pin 1
+#ifndef SERIAL_COMMANDS
+#define SERIAL_COMMANDS (INSTRUMENTATION || TELEMETRY || RECORDING)
+#endif
+
+// Pots watered by the board, each with its own soil sensor, pump and moisture setpoint, up to 8.
+// More than one needs the soil sensors on a CD4051 multiplexer and the pumps on 74HC595 shift registers,
+// see "Zones"
+#ifndef ZONE_COUNT
+#define ZONE_COUNT 1
+#endif
+
+// Send the inputs of the control logic over serial as they change, host/trace_replay.cpp replays them
+#ifndef RECORDING
+#define RECORDING 0
+#endif
+
+// Wiring revision, see "Board": BOARD_POT for the Tinkercad circuit with one pot, BOARD_ZONES
+// with shift registers and a soil multiplexer, which more than one zone needs, BOARD_POT_R2 for
+// a one pot board rewired so the lamp dims, only when asked for with -DBOARD=BOARD_POT_R2
+#define BOARD_POT 1
+#define BOARD_ZONES 2
+#define BOARD_POT_R2 3
+#ifndef BOARD
+#define BOARD (ZONE_COUNT > 1 ? BOARD_ZONES : BOARD_POT)
+#endif
+
+// Serial port uses pins 0 and 1, the menu button on pin 1 is not read while it is on
+#define SERIAL_LINK (INSTRUMENTATION || TELEMETRY || SERIAL_COMMANDS || RECORDING)
+const long SERIAL_BAUD = 9600;
+static_assert(!SERIAL_LINK || SERIAL_COMMANDS, "the serial port takes the menu button, it needs SERIAL_COMMANDS for the menu command");
 
 // LCD interface initialization
 Adafruit_LiquidCrystal lcd(0);
+const int LCD_COLUMNS = 16;
+const int LCD_ROWS = 2;
+const int LCD_CELLS_PER_TICK = 6; // lcd writes sent per display task run, each takes ~1ms over I2C
+
+/*========== Board =============*/
+// Both revisions are an Arduino Uno (ATmega328P), the traits of a revision give its pins and
+// the calibration of its sensors. Everything is constexpr, so pins stay compile time constants
+// for FastPin and the static_asserts below check a wiring before it reaches a board.
+
+const int NO_PIN = -1; // part not fitted on this revision
+
+template <int REVISION>
+struct BoardTraits;
+
+// The Tinkercad circuit, one pot with the RGB led on its own pins
+template <>
+struct BoardTraits<BOARD_POT> {
+    static constexpr bool SHIFT_REGISTERS = false;
+    static constexpr int RED_RGB_PIN = 13;
+    static constexpr int BLUE_RGB_PIN = 12;
+    static constexpr int GREEN_RGB_PIN = 11;
+    static constexpr int SHIFT_DATA_PIN = NO_PIN;
+    static constexpr int SHIFT_LATCH_PIN = NO_PIN;
+    static constexpr int SHIFT_CLOCK_PIN = NO_PIN;
+    static constexpr int BUZZER = 6;
+    static constexpr int LAMP_PIN = 16;
+    static constexpr int ULTRASONIC_PIN = 5;
+    static constexpr int TEMPERATURE_PIN = A0;
+    static constexpr int LIGHT_SENSOR_PIN = A3;
+    static constexpr int SOIL_MOISTURE_PIN = A1;
+    static constexpr int BTN_TOGGLE_PIN = 7;
+    static constexpr int UP_BTN_PIN = 10;
+    static constexpr int DOWN_BTN_PIN = 8;
+    static constexpr int MENU_BTN_PIN = 1;
+    static constexpr int DC_INPUT1_PIN = 2;
+    static constexpr int DC_INPUT2_PIN = 4;
+    static constexpr int DC_PWM = 3;
+    static constexpr int DC_PUMP_PIN = 9;
+    // Known limitation: pin 3 gets its PWM from timer 2, which tone() takes for the buzzer. While a
+    // beep sounds the lift motor loses its duty, the next analogWrite() of keep_gap() brings it back.
+    static constexpr bool LIFT_PWM_SHARES_TONE = true;
+    static constexpr bool LAMP_DIMMING = false; // A2 has no PWM, the lamp is only on or off
+
+    static constexpr long ADC_VREF_MV = 5000;
+    static constexpr int LIGHT_FULL_SCALE = 900; // highest reading the light sensor gave
+    static constexpr int SOIL_FULL_SCALE = 876; // highest reading the soil sensor gave
+    static constexpr long ECHO_CM_PER_100000_US = 1723; // sound travels 0.0344 cm/us, there and back
+};
+
+// Several pots: a chain of 74HC595 shift registers on the former RGB pins switches the RGB led,
+// the pumps and the select inputs of a CD4051 multiplexer in front of the soil sensors, see "Zones"
+template <>
+struct BoardTraits<BOARD_ZONES> : BoardTraits<BOARD_POT> {
+    static constexpr bool SHIFT_REGISTERS = true;
+    static constexpr int RED_RGB_PIN = NO_PIN;
+    static constexpr int BLUE_RGB_PIN = NO_PIN;
+    static constexpr int GREEN_RGB_PIN = NO_PIN;
+    static constexpr int SHIFT_DATA_PIN = 11;
+    static constexpr int SHIFT_LATCH_PIN = 12;
+    static constexpr int SHIFT_CLOCK_PIN = 13;
+    static constexpr int DC_PUMP_PIN = NO_PIN;
+};
+
+// The one pot board rewired so the lamp and the lift motor get PWM that tone() leaves alone:
+// both on timer 1, the lamp on pin 10 so it dims and the motor on 9. The up button and the pump
+// move to pins 3 and A2 for them, the circuit has to be wired to match.
+template <>
+struct BoardTraits<BOARD_POT_R2> : BoardTraits<BOARD_POT> {
+    static constexpr int LAMP_PIN = 10;
+    static constexpr int UP_BTN_PIN = 3;
+    static constexpr int DC_PWM = 9; // timer 1, the buzzer does not get in the way
+    static constexpr int DC_PUMP_PIN = A2;
+    static constexpr bool LAMP_DIMMING = true;
+    static constexpr bool LIFT_PWM_SHARES_TONE = false;
+};
+
+typedef BoardTraits<BOARD> Board;
 
 // Arduino's pins numbers for RGB
-const int RED_RGB_PIN = 13;
-const int BLUE_RGB_PIN = 12;
-const int GREEN_RGB_PIN = 11;
+const int RED_RGB_PIN = Board::RED_RGB_PIN;
+const int BLUE_RGB_PIN = Board::BLUE_RGB_PIN;
+const int GREEN_RGB_PIN = Board::GREEN_RGB_PIN;
+
+// Pins of the shift register chain
+const int SHIFT_DATA_PIN = Board::SHIFT_DATA_PIN;
+const int SHIFT_LATCH_PIN = Board::SHIFT_LATCH_PIN;
+const int SHIFT_CLOCK_PIN = Board::SHIFT_CLOCK_PIN;
 
 // Arduino's pin number for buzzer
-const int BUZZER = 6;
+const int BUZZER = Board::BUZZER;
 
 // Arduino's pin for bulb light
-const int LAMP_PIN = 16;
+const int LAMP_PIN = Board::LAMP_PIN;
 
 // Arduino's pins for ultrasonic sensor, one pin for both trigger and echo
-const int ULTRASONIC_PIN = 5;
+const int ULTRASONIC_PIN = Board::ULTRASONIC_PIN;
 
 // Arduino's pin for temperature sensor
-const int TEMPERATURE_PIN = A0;
+const int TEMPERATURE_PIN = Board::TEMPERATURE_PIN;
 
 // Arduino's pin for light sensor
-const int LIGHT_SENSOR_PIN = A3;
+const int LIGHT_SENSOR_PIN = Board::LIGHT_SENSOR_PIN;
 
 // Arduino's pin for soil moisture senseor
-const int SOIL_MOISTURE_PIN = A1;
+const int SOIL_MOISTURE_PIN = Board::SOIL_MOISTURE_PIN; // common pin of the multiplexer with more than one zone
 
 // Arduino's pins for control buttons
-const int BTN_TOGGLE_PIN = 7;
-const int UP_BTN_PIN = 10;
-const int DOWN_BTN_PIN = 8;
-const int MENU_BTN_PIN = 1;
+const int BTN_TOGGLE_PIN = Board::BTN_TOGGLE_PIN;
+const int UP_BTN_PIN = Board::UP_BTN_PIN;
+const int DOWN_BTN_PIN = Board::DOWN_BTN_PIN;
+const int MENU_BTN_PIN = Board::MENU_BTN_PIN;
 
 // Arduino's pins for DC motor
-const int DC_INPUT1_PIN = 2;
-const int DC_INPUT2_PIN = 4;
-const int DC_PWM = 3; // to write analag signal
-const int DC_PUMP_PIN = 9; // To open/close water
+const int DC_INPUT1_PIN = Board::DC_INPUT1_PIN;
+const int DC_INPUT2_PIN = Board::DC_INPUT2_PIN;
+const int DC_PWM = Board::DC_PWM; // to write analag signal
+const int DC_PUMP_PIN = Board::DC_PUMP_PIN; // To open/close water
+
+// Ports of the ATmega328P: pins 0-7 are port D, 8-13 port B and A0-A5 port C
+const int PORT_B = 1;
+const int PORT_C = 2;
+const int PORT_D = 3;
+
+constexpr int pin_port(int pin){
+    return pin < 8 ? PORT_D : (pin < 14 ? PORT_B : PORT_C);
+}
+
+constexpr int pin_bit(int pin){
+    return pin < 8 ? pin : (pin < 14 ? pin - 8 : pin - 14);
+}
+
+// tone() takes timer 2 for the buzzer, which also gives pins 3 and 11 their PWM, so they have none with a buzzer
+constexpr bool pin_has_pwm(int pin){
+    return pin == 5 || pin == 6 || pin == 9 || pin == 10 || ((pin == 3 || pin == 11) && BUZZER == NO_PIN);
+}
+
+constexpr bool pin_is_analog(int pin){
+    return pin >= A0 && pin <= A0 + 5;
+}
+
+/* true when pin is none of the others, NO_PIN is never taken */
+constexpr bool pin_free(int){
+    return true;
+}
+
+template <class... Pins>
+constexpr bool pin_free(int pin, int other, Pins... others){
+    return (pin == NO_PIN || pin != other) && pin_free(pin, others...);
+}
+
+constexpr bool pins_distinct(){
+    return true;
+}
+
+template <class... Pins>
+constexpr bool pins_distinct(int pin, Pins... others){
+    return pin_free(pin, others...) && pins_distinct(others...);
+}
+
+// The serial port takes pins 0 and 1 when it is on, the menu button is not read then
+static_assert(pins_distinct(RED_RGB_PIN, BLUE_RGB_PIN, GREEN_RGB_PIN, SHIFT_DATA_PIN, SHIFT_LATCH_PIN, SHIFT_CLOCK_PIN,
+                            BUZZER, LAMP_PIN, ULTRASONIC_PIN, TEMPERATURE_PIN, LIGHT_SENSOR_PIN, SOIL_MOISTURE_PIN,
+                            BTN_TOGGLE_PIN, UP_BTN_PIN, DOWN_BTN_PIN, SERIAL_LINK ? NO_PIN : MENU_BTN_PIN,
+                            SERIAL_LINK ? 0 : NO_PIN, SERIAL_LINK ? 1 : NO_PIN,
+                            DC_INPUT1_PIN, DC_INPUT2_PIN, DC_PWM, DC_PUMP_PIN), "two parts share a pin");
+static_assert(pin_has_pwm(DC_PWM) || (Board::LIFT_PWM_SHARES_TONE && (DC_PWM == 3 || DC_PWM == 11)),
+              "lift motor duty needs a PWM pin");
+static_assert(pin_is_analog(TEMPERATURE_PIN) && pin_is_analog(LIGHT_SENSOR_PIN) && pin_is_analog(SOIL_MOISTURE_PIN),
+              "analog sensors need pins of the ADC");
+static_assert(pin_port(ULTRASONIC_PIN) == PORT_D, "echo edges are timed by the port D interrupt PCINT2_vect");
+static_assert(pin_port(BTN_TOGGLE_PIN) != PORT_C && pin_port(UP_BTN_PIN) != PORT_C && pin_port(DOWN_BTN_PIN) != PORT_C
+              && pin_port(MENU_BTN_PIN) != PORT_C, "button edges are only reported for ports B and D");
+static_assert(Board::SHIFT_REGISTERS == (ZONE_COUNT > 1), "more than one zone needs BOARD_ZONES and it needs more than one zone");
+
+/*
+Output and input of a pin known at compile time. On the board the port and bit are constants,
+so write() compiles to a single sbi or cbi instead of the pin table lookups of digitalWrite().
+Only for pins that never get analogWrite(), digitalWrite() also turns off their PWM.
+Writes to NO_PIN go nowhere.
+*/
+template <int PIN>
+struct FastPin {
+    static_assert(PIN == NO_PIN || (PIN >= 0 && PIN < A0 + 6), "not a pin of the Uno");
+    static constexpr uint8_t MASK = PIN == NO_PIN ? 0 : 1 << pin_bit(PIN);
+
+    static void write(bool high){
+        if(PIN == NO_PIN){
+            return;
+        }
+#if defined(__AVR__)
+        if(high){
+            output_register() |= MASK;
+        }else{
+            output_register() &= ~MASK;
+        }
+#else
+        digitalWrite(PIN, high ? HIGH : LOW);
+#endif
+    }
+
+    static bool read(){
+#if defined(__AVR__)
+        return input_register() & MASK;
+#else
+        return digitalRead(PIN) == HIGH;
+#endif
+    }
+
+#if defined(__AVR__)
+    static volatile uint8_t& output_register(){
+        return pin_port(PIN) == PORT_D ? PORTD : (pin_port(PIN) == PORT_B ? PORTB : PORTC);
+    }
+
+    static volatile uint8_t& input_register(){
+        return pin_port(PIN) == PORT_D ? PIND : (pin_port(PIN) == PORT_B ? PINB : PINC);
+    }
+#endif
+};
 
 // Store current sensors values
 int current_distance = 0;
 int current_temperature = 0;
 int current_light_intensity = 0;
-int current_soil_moisture = 0;
+int current_soil_moisture[ZONE_COUNT]; // per zone
+int current_soil_moisture_tenths[ZONE_COUNT]; // same in tenths of percent for the watering engine
+bool temperature_sensor_ok = false; // false while the sensor gives no plausible samples
+bool soil_sensor_ok[ZONE_COUNT];
 
 // keep track of milliseconds passed since the Arduino board began running the current program
 unsigned long prev_milliseconds = 0;
@@ -61,45 +302,290 @@ const int LIGHT_OPTION = 2;
 const int DISTANCE_OPTION = 3;
 const int SOIL_OPTION = 4;
 const int BACKGROUND_OPTION = 5;
-int btn_toggle = 1;  // move between internal options
+int selected_setpoint = 0;  // setpoint toggle btn moved to when an option has several
+int selected_zone = 0; // zone shown on home and edited in the soil option
+int home_view = 0; // 0 for sensor values, then history of each sensor, toggle btn moves on
+int history_shown = 0; // history entry shown, up btn goes back in time
 bool no_buzzer = false;
-// Store buttons state
+// Store buttons state, set from one button event at a time
 bool menu_btn_state = false;
 bool toggle_btn_state = false;
 bool up_btn_state = false;
 bool down_btn_state = false;
-const int BTN_DELAY_TIME = 3; // delay after button is pressed
-const int BTN_STAY_TIME = 10; // stay in loop if up/down is pressed
+bool toggle_long_press = false;
+bool toggle_pending = false; // toggle btn is down and not yet held long, it acts on release
+bool page_redraw = true; // print static text of current menu option on next ui tick
 // set default values and store entered values if any
 int max_temperature = 35; //celcuis
 int min_temperature = 20;
 int distance_gap = 50; // default 60 cm
-int max_light_intensity = 50; // default 50
-int min_soil_moinstrure = 50; // default 50
+int gap_tolerance = 10; // cm the arm may be off distance_gap before keep_gap() moves it
+int max_light_intensity = 50; // percent the lamp tops the daylight up to
+int light_band = 5; // percent the daylight is below max_light_intensity before the lamp goes on, above before it goes off
+int min_soil_moinstrure[ZONE_COUNT]; // per zone, default 50 set by zones_start()
+const int DEFAULT_SOIL_MOISTURE = 50;
 bool is_error = false; // used to turn off/on rgb
-unsigned long WATERING_INTERVAL_3S = 3000; // used to water plants every ns interval
-unsigned long prev_watering_time = 0; // used to water plants after certain time 
+const int PUMP_PULSE_TIME = 400; // how long pump is open on each watering with PULSE_WATERING
+bool pump_running[ZONE_COUNT];
+unsigned long pump_start_time[ZONE_COUNT];
+const int PUMPS_AT_ONCE = 1; // pumps open together, they share one supply
+
+// Watering engine, see water_plants(), state is kept per zone
+const int WATER_HYSTERESIS = 50; // tenths of percent above min_soil_moinstrure a dose aims for
+const unsigned long WATER_MIN_DOSE = 200; // ms the pump is open at least
+const unsigned long WATER_MAX_DOSE = 4000;
+const int WATER_MIN_GAIN = 2; // tenths of percent per second of pump
+const int WATER_MAX_GAIN = 100;
+const unsigned long WATER_SLOPE_TIME = 15000; // ms between moisture checks while a dose soaks in, at least
+const int WATER_SOAKED_RISE = 2; // tenths of percent, a smaller rise between checks means the dose has soaked in
+const unsigned long WATER_MAX_SOAK = 900000; // ms a dose may take to reach the sensor
+const int WATER_NO_RESPONSE_LIMIT = 3; // doses in a row the sensor did not see before watering stops
+const int WATER_IDLE = 0;
+const int WATER_DOSING = 1;
+const int WATER_SOAKING = 2;
+const int WATER_START_GAIN = 50; // high so the first dose is small
+int water_state[ZONE_COUNT];
+unsigned long water_dose[ZONE_COUNT]; // ms the pump is open for the current dose
+int water_gain[ZONE_COUNT]; // learned rise per second of pump
+unsigned long water_delay[ZONE_COUNT]; // learned ms from the start of a dose to the first rise at the sensor
+int water_start_moisture[ZONE_COUNT]; // when the current dose started
+int water_check_moisture[ZONE_COUNT]; // at the last check while soaking
+unsigned long water_check_time[ZONE_COUNT];
+unsigned long water_rise_time[ZONE_COUNT]; // millis() of the first rise after the dose, 0 before it
+int water_no_response[ZONE_COUNT];
+bool water_fault[ZONE_COUNT]; // doses never reached the sensor, empty tank or blocked hose
+int water_first_zone = 0; // zone water_task() looks at first, moves on every run so zones take turns at the pump
+int lift_direction = 0; // 1 lifting up, -1 sinking down, 0 stopped
+
+// Lamp arm position controller, see keep_gap()
+const int LIFT_DEADBAND = 2; // cm, a correction ends once the arm is this close to the gap
+const int LIFT_KP = 24; // pwm per cm of error
+const int LIFT_KI = 2; // pwm per cm of error summed over a second of control ticks
+const int LIFT_TICKS_PER_S = 20; // keep_gap() runs every 50 ms
+const int LIFT_MIN_PWM = 90; // lowest duty that still moves the arm
+const int LIFT_MAX_PWM = 255;
+const int LIFT_RAMP = 40; // most the duty changes in one control tick
+const unsigned long LIFT_TIMEOUT = 60000; // ms one correction may take
+const unsigned long LIFT_RETRY_TIME = 60000; // ms the arm rests after a stall or timeout
+int lift_pwm = 0; // signed duty, positive lifts up
+long lift_integral = 0; // error summed over control ticks
+bool lift_correcting = false;
+unsigned long lift_start_time = 0;
+bool lift_fault = false; // arm stalled or never reached the gap
+unsigned long lift_fault_time = 0;
+
+// Grow lamp, see check_light()
+const bool LAMP_DIMMING = Board::LAMP_DIMMING; // duty follows the missing daylight, else the lamp is only on or off
+static_assert(!LAMP_DIMMING || pin_has_pwm(LAMP_PIN), "a dimmed lamp needs a PWM pin");
+const unsigned long LAMP_MIN_ON_TIME = 600000; // ms the lamp stays on at least, every switch wears the bulb and relay
+const unsigned long LAMP_MIN_OFF_TIME = 300000; // ms it stays off at least, also after a restart
+const unsigned long LAMP_SETTLE_TIME = 2000; // ms until the filtered light sensor shows a change of the lamp
+const int LAMP_LEARN_DUTY = 64; // duty changes at least this big teach lamp_gain
+const int LAMP_MIN_DUTY = 32; // dimmest duty the lamp runs at
+const int LAMP_MAX_GAIN = 100;
+bool lamp_on = false;
+int lamp_duty = 0; // 0-255, only 0 or 255 without dimming
+int lamp_gain = 0; // percent the lamp adds at the light sensor at full duty, learned, 0 before the first switch
+unsigned long lamp_switch_time = 0; // millis() the lamp last went on or off
+unsigned long lamp_change_time = 0; // millis() of the last duty change
+int lamp_learn_light = -1; // light sensor before a duty change lamp_gain is learned from, -1 when there is none
+int lamp_learn_duty = 0; // that duty change
+unsigned long lamp_switches = 0; // on and off switches, both count
+unsigned long lamp_full_ms = 0; // lamp time at full duty, dimmed time counts in part
+unsigned long lamp_count_time = 0; // millis() lamp_full_ms was counted to
+
+// Ultrasonic distance measured in background, see read_distance()
+const unsigned long ECHO_TIMEOUT_US = 25000; // give up on ultrasonic echo after ~4m of travel
+const unsigned long PING_INTERVAL = 60; // ms between pings, lets echoes of last ping die out
+const int MAX_DISTANCE = 335; // cm, sensor range is 2cm to 3m
+volatile unsigned long echo_rise_time = 0;
+volatile unsigned long echo_fall_time = 0;
+volatile bool echo_rised = false;
+volatile bool echo_done = false;
+volatile bool echo_level = false; // last level of ultrasonic pin seen by the interrupt
+volatile bool ping_active = false;
+unsigned long ping_time = 0; // micros() when last ping was sent
+unsigned long ping_millis = 0; // millis() when last ping was sent
+bool distance_valid = false; // false when echoes keep failing, current_distance keeps last filtered value
+
+// Analog sensors scanned in background by the ADC, see adc_read()
+const int ADC_CHANNEL_COUNT = 3;
+const int ADC_CHANNEL_PINS[ADC_CHANNEL_COUNT] = {TEMPERATURE_PIN, LIGHT_SENSOR_PIN, SOIL_MOISTURE_PIN};
+const int ADC_SOIL_CHANNEL = 2; // last, its zones have the filters from adc_filters[ADC_SOIL_CHANNEL] on
+const int ADC_FILTER_COUNT = ADC_CHANNEL_COUNT - 1 + ZONE_COUNT;
+const int ADC_OVERSAMPLING = 16; // conversions averaged into one sample
+// A scan converts every channel ADC_OVERSAMPLING times, one more for the first channel and one after the
+// last that had started when it ended, then the ADC is off until adc_task() starts the next scan
+const int ADC_SCAN_CONVERSIONS = ADC_CHANNEL_COUNT * ADC_OVERSAMPLING + 2;
+const unsigned long ADC_SCAN_TIME = 20; // ms from one scan to the next, a scan takes ~5ms
+unsigned long adc_scans = 0; // scans since idle_reset()
+const int ADC_BUFFER_SIZE = 16; // power of two
+volatile uint16_t adc_buffer[ADC_BUFFER_SIZE]; // sample value in bit 0-9, zone in bit 10-12, channel from bit 13
+volatile uint8_t adc_head = 0; // written only by producer (ADC interrupt)
+volatile uint8_t adc_tail = 0; // written only by consumer (adc_drain)
+volatile unsigned int adc_overruns = 0; // samples dropped because buffer was full
+volatile uint8_t adc_zone = 0; // zone the soil multiplexer is switched to
+volatile bool adc_zone_changed = false; // soil sample being summed started on the previous zone
+
+// Buttons are read when a pin change interrupt reports an edge, see scan_buttons()
+const int BTN_COUNT = 4;
+const int MENU_BUTTON = 0; // index in buttons
+const int TOGGLE_BUTTON = 1;
+const int UP_BUTTON = 2;
+const int DOWN_BUTTON = 3;
+const int BTN_DEBOUNCE_TIME = 20; // ms without edges before the level is trusted
+const int BTN_LONG_PRESS_TIME = 1000;
+const int BTN_REPEAT_DELAY = 500; // ms held before up/down start repeating
+const int BTN_REPEAT_TIME = 150;
+// Button event types, an event is the type in the low nibble and button index in the high nibble
+const int BTN_NONE = 0;
+const int BTN_PRESS = 1;
+const int BTN_RELEASE = 2;
+const int BTN_LONG_PRESS = 3;
+const int BTN_REPEAT = 4;
+const int BTN_QUEUE_SIZE = 8; // power of two
+volatile unsigned long button_edge_time = 0; // millis() of last edge on any button
+volatile bool button_edge_pending = false;
+uint8_t button_queue[BTN_QUEUE_SIZE];
+uint8_t button_queue_head = 0;
+uint8_t button_queue_tail = 0;
+
+// Message shown on lcd for a limited time without blocking, see print_message()
+bool message_shown = false;
+unsigned long message_time = 0;
+unsigned int message_hold_time = 0;
+
+/*========== LCD frame =============*/
+
+/*
+Shadow of the lcd screen. Menu and messages write to a 32 byte frame with the same
+calls as lcd, and refresh() sends only the cells that changed since last time.
+Consecutive changed cells are sent after a single setCursor, clear() never reaches the lcd.
+*/
+class LcdFrame : public Print {
+public:
+    LcdFrame(){
+        memset(cells, ' ', sizeof(cells)); // lcd is blank after begin()
+        dirty = 0;
+        col = 0;
+        row = 0;
+        lcd_position = -1;
+        cursor_on = false;
+        cursor_shown = false;
+    }
+
+    /* Blank the frame, cells already blank are not sent again */
+    void clear(){
+        for (int i = 0; i < LCD_ROWS * LCD_COLUMNS; ++i)
+        {
+            set_cell(i, ' ');
+        }
+        setCursor(0,0);
+    }
+
+    void setCursor(int new_col, int new_row){
+        col = new_col;
+        row = new_row;
+    }
+
+    /* Show underline cursor at the position of the next write */
+    void cursor(){
+        cursor_on = true;
+    }
+
+    void noCursor(){
+        cursor_on = false;
+    }
+
+    /* Write one character at current position, characters after the last column are dropped */
+    size_t write(uint8_t c) override {
+        if(col < LCD_COLUMNS && row < LCD_ROWS){
+            set_cell(row * LCD_COLUMNS + col, c);
+        }
+        ++col;
+        return 1;
+    }
+    using Print::write;
+
+    /*
+    Send changed cells to lcd
+    @param int budget max number of lcd writes, setCursor included, rest is sent on next call
+    */
+    void refresh(int budget){
+        for (int i = 0; i < LCD_ROWS * LCD_COLUMNS && dirty != 0 && budget > 0; ++i)
+        {
+            unsigned long bit = 1UL << i;
+            if(!(dirty & bit)){
+                continue;
+            }
+            if(lcd_position != i){
+                lcd.setCursor(i % LCD_COLUMNS, i / LCD_COLUMNS);
+                --budget;
+            }
+            lcd.write(cells[i]);
+            dirty &= ~bit;
+            --budget;
+            // lcd address does not continue from end of row 1 to row 2
+            lcd_position = ((i + 1) % LCD_COLUMNS == 0)? -1 : i + 1;
+        }
+        if(cursor_on != cursor_shown){
+            cursor_shown = cursor_on;
+            if(cursor_on){
+                lcd.cursor();
+            }else{
+                lcd.noCursor();
+            }
+        }
+        // put visible cursor back at write position once everything is sent
+        int cursor_position = row * LCD_COLUMNS + col;
+        if(cursor_on && dirty == 0 && lcd_position != cursor_position && col < LCD_COLUMNS){
+            lcd.setCursor(col, row);
+            lcd_position = cursor_position;
+        }
+    }
+
+private:
+    void set_cell(int index, char c){
+        if(cells[index] != c){
+            cells[index] = c;
+            dirty |= 1UL << index;
+        }
+    }
+
+    char cells[LCD_ROWS * LCD_COLUMNS];
+    unsigned long dirty; // one bit per cell not yet sent to lcd
+    int col; // position of next write
+    int row;
+    int lcd_position; // cell the lcd writes to next, -1 when unknown
+    bool cursor_on;
+    bool cursor_shown;
+};
+
+LcdFrame screen;
 
 /*========== Functions =============*/
 
 /*
-Print a string to lcd screen
-@param String msg_row_1 display in row 1
-@param String msg_row_2 display in row 2
-@param int delay_val delay time before clearing screen
-@param bool no_clear if true clear screen before and after msg
+Print a string to lcd screen, kept in flash when given as F("text") or in RAM as const char*
+@param msg_row_1 display in row 1
+@param msg_row_2 display in row 2
+@param int hold_time how long the message stays on screen before the menu is drawn again, 0 to not hold
+@param bool no_clear if true clear screen before msg
 */
-void print_message(String msg_row_1, String msg_row_2, int delay_val = 100, bool no_clear = false){
+template <class Text>
+void print_message(Text msg_row_1, Text msg_row_2, int hold_time = 100, bool no_clear = false){
     if(!no_clear){
-        lcd.clear();
+        screen.clear();
     }
-    lcd.setCursor(0,0);
-    lcd.print(msg_row_1);
-    lcd.setCursor(0,1);
-    lcd.print(msg_row_2);
-    delay(delay_val);
-    if(!no_clear){
-        lcd.clear();
+    screen.setCursor(0,0);
+    screen.print(msg_row_1);
+    screen.setCursor(0,1);
+    screen.print(msg_row_2);
+    if(hold_time > 0){
+        // ui task clears the screen when hold time is over instead of waiting here
+        message_shown = true;
+        message_time = millis();
+        message_hold_time = hold_time;
     }
 }
 
@@ -109,534 +595,3506 @@ Print a int to lcd screen
 @param int col
 @param int row
 @param int num_of_cells to clear at specified position before printing the message.
-@param String msg_after print messgae after printig first message, default empty
+@param const char* msg_after print messgae after printig first message, default empty
 */
-void print_message(int msg, int col, int row, int num_of_cells = 0, String msg_after = ""){
+void print_message(int msg, int col, int row, int num_of_cells = 0, const char* msg_after = ""){
     for (int i = 0; i < num_of_cells; ++i)
     {
-        lcd.setCursor(col + i,row);
-        lcd.write(' ');
+        screen.setCursor(col + i,row);
+        screen.write(' ');
     }
-    lcd.setCursor(col,row);
-    lcd.print(msg);
-    lcd.print(msg_after);
+    screen.setCursor(col,row);
+    screen.print(msg);
+    screen.print(msg_after);
 }
 
+#if defined(__AVR__)
+extern char __heap_start;
+extern char* __brkval;
+const uint8_t MEMORY_PAINT = 0xC5; // fill of free SRAM the stack has not reached yet
+#endif
 
-/*
-Read ultra sonic distance's sensor value
-@return int distance in cm
-*/
-int read_distance(int triggerPin, int echoPin)
-{
-    pinMode(triggerPin, OUTPUT);  // Clear the trigger
-    digitalWrite(triggerPin, LOW);
-    delayMicroseconds(2);
-    // Sets the trigger pin to HIGH state for 10 microseconds
-    digitalWrite(triggerPin, HIGH);
-    delayMicroseconds(10);
-    digitalWrite(triggerPin, LOW);
-    pinMode(echoPin, INPUT);
-    // sound travel time is 0.0344 cm/microsocnd, for forward and backward divide with 2
-    // Reads the echo pin, and returns the sound wave travel time in microseconds
-    return 0.01723 * pulseIn(echoPin, HIGH);
+/* Fill the SRAM between heap and stack with MEMORY_PAINT, setup() does it once with INSTRUMENTATION */
+void memory_paint(){
+#if defined(__AVR__)
+    char top;
+    for (char* p = (__brkval == 0 ? &__heap_start : __brkval); p < &top - 32; ++p)
+    {
+        *p = MEMORY_PAINT;
+    }
+#endif
 }
 
 /*
-Read temperature's sensor value
-@return int temperature in celcuis
+Free SRAM above the heap the stack has never reached since memory_paint()
+@return int bytes, 0 on the host
 */
-int read_temperature(int temperature_sensor_pin){
-    // Get the voltage reading from the TMP36
-    float reading = analogRead(temperature_sensor_pin);
-    // Convert that reading into voltage
-    float voltage = reading * (5.0 / 1024.0);
-    // Convert the voltage into the temperature in Celsius and return it
-    return round((voltage - 0.5) * 100.0);
+int memory_stack_unused(){
+#if defined(__AVR__)
+    char top;
+    const char* p = (__brkval == 0 ? &__heap_start : __brkval);
+    int count = 0;
+    while(p < &top && (uint8_t)*p == MEMORY_PAINT){
+        ++p;
+        ++count;
+    }
+    return count;
+#else
+    return 0;
+#endif
 }
 
 /*
-Read light intensity sensor
-@return int light intensity in percent
+Heap in use, stays 0 as long as nothing allocates
+@return int bytes
 */
-int read_light_intensity(){
-    // Get the voltage reading from the light sensor
-    float reading = analogRead(LIGHT_SENSOR_PIN);
-    //The highest reading the sensor gave is 900, divdie the reading with 900 and multiply with 100 to get value present
-    return (reading/900)*100.0;
+int memory_heap_used(){
+#if defined(__AVR__)
+    return __brkval == 0 ? 0 : __brkval - &__heap_start;
+#else
+    return 0;
+#endif
 }
 
-/*
-Read soil moisture sensor
-@return int soil moisture in percent
-*/
-int read_soil_moisture(){
-    // Get the voltage reading from the soil sensor
-    float reading = analogRead(SOIL_MOISTURE_PIN);
-    //The highest reading the sensor gave is 876, divdie the reading with 876 and multiply with 100 to get value present
-    return (reading/876)*100.0;
-}
+/*========== Buttons =============*/
 
-/*Print current sensor's values, prints the following:
-DI: Distance in cm
-TE: Temperature in celcuis
-LI: light intensity
-SM: soil moisture
-*/
-void print_sensors_values(){
-    lcd.setCursor(0,0);
-    lcd.print("DI:");
-    lcd.print(current_distance);
-    lcd.print("CM,");
+/* Debounced state of a button */
+struct Button {
+    int pin;
+    bool pressed;
+    bool long_press_sent;
+    unsigned long press_time;
+    unsigned long next_repeat; // millis() of next repeat event while held
+};
 
-    lcd.print("TE:");
-    lcd.print(current_temperature);
-    lcd.print("  ");
+Button buttons[BTN_COUNT] = {
+    {SERIAL_LINK ? -1 : MENU_BTN_PIN, false, false, 0, 0}, // -1 is never read
+    {BTN_TOGGLE_PIN, false, false, 0, 0},
+    {UP_BTN_PIN, false, false, 0, 0},
+    {DOWN_BTN_PIN, false, false, 0, 0},
+};
 
-    lcd.setCursor(0,1);
-    lcd.print("LT:");
-    lcd.print(current_light_intensity);
-    lcd.print(",");
-    lcd.print("SM:");
-    lcd.print(current_soil_moisture);
-    lcd.print("  ");
+/* Bit of pin in the input register of port, 0 when the pin is on another port or not fitted */
+constexpr uint8_t port_bit(int port, int pin){
+    return (pin >= 0 && pin_port(pin) == port) ? 1 << pin_bit(pin) : 0;
 }
 
-/* Set RGB colors
-@param int red
-@param int green
-@param int blue
- */
-void set_rgb_color(int red_value,int green_value,int blue_value)
-{
-    analogWrite(RED_RGB_PIN, red_value);
-    analogWrite(GREEN_RGB_PIN, green_value);
-    analogWrite(BLUE_RGB_PIN, blue_value);
+// Buttons of port D in PIND, that port also has the ultrasonic pin
+const uint8_t PORT_D_BUTTONS = port_bit(PORT_D, SERIAL_LINK ? NO_PIN : MENU_BTN_PIN) | port_bit(PORT_D, BTN_TOGGLE_PIN)
+                               | port_bit(PORT_D, UP_BTN_PIN) | port_bit(PORT_D, DOWN_BTN_PIN);
+
+/* Called from pin change interrupts on every edge of a button, bounces included */
+void button_edge(){
+    button_edge_time = millis();
+    button_edge_pending = true;
 }
 
-/* Set min and max temperature.
-@param interval to increase/decrease with interval value
- */
-void set_temperature_interval(int interval){
+/* Add an event to the button queue, dropped when the queue is full */
+void push_button_event(int button, int type){
+    uint8_t next = (button_queue_head + 1) & (BTN_QUEUE_SIZE - 1);
+    if(next != button_queue_tail){
+        button_queue[button_queue_head] = (button << 4) | type;
+        button_queue_head = next;
+    }
+}
 
-    unsigned long time_begin = millis();;
-    unsigned long time_end = 0;
-    do{
+/*
+Take the oldest button event
+@return int event, BTN_NONE when there is no event
+*/
+int next_button_event(){
+    if(button_queue_tail == button_queue_head){
+        return BTN_NONE;
+    }
+    int event = button_queue[button_queue_tail];
+    button_queue_tail = (button_queue_tail + 1) & (BTN_QUEUE_SIZE - 1);
+    return event;
+}
 
-    // Switch between min and max value based on btn state
-    if(digitalRead(BTN_TOGGLE_PIN) == HIGH || toggle_btn_state){
-        ++btn_toggle;
-        btn_toggle = ((btn_toggle % 2) == 1)? 1:2;
-    }
-
-    String row_1_msg = "Min temp:";
-    String row_2_msg = "Max temp:";
-    int column = row_2_msg.length();
-
-    // print stored values
-    print_message(row_1_msg + String(min_temperature),row_2_msg + String(max_temperature),0,true);
-
-    // Set min temparature
-    if(btn_toggle == 1){
-        lcd.setCursor(12,1);
-        lcd.write(' ');
-        lcd.setCursor(12,0);
-        lcd.write('<');
-        lcd.setCursor(column,0);
-        // increase value
-        while(digitalRead(UP_BTN_PIN) == HIGH){
-            min_temperature += interval; 
-            if(min_temperature > 140){ // value limit
-                min_temperature = 140;
-            }
-            print_message(min_temperature, column,0,3);
-            delay(BTN_DELAY_TIME);
-            time_end = millis();
-            time_begin += BTN_STAY_TIME;
-        }
-        // decrease value
-        while(digitalRead(DOWN_BTN_PIN) == HIGH){
-            min_temperature -= interval; 
-            if(min_temperature < 0){ // value limit
-                min_temperature = 0;
-            }
-            print_message(min_temperature,column ,0,3);
-            delay(BTN_DELAY_TIME);
-            time_end = millis();
-            time_begin += BTN_STAY_TIME;
-        }
-    }
-
-    // Set max temparature
-    if(btn_toggle == 2){
-        lcd.setCursor(12,0);
-        lcd.write(' ');
-        lcd.setCursor(12,1);
-        lcd.write('<');
-        lcd.setCursor(column,1);
-        // increase value
-        while(digitalRead(UP_BTN_PIN) == HIGH){
-            max_temperature += interval; 
-            if(max_temperature > 140){ // value limit
-                max_temperature = 140;
-            }
-            print_message(max_temperature, column,1,3);
-            delay(BTN_DELAY_TIME);
-            time_end = millis();
-            time_begin += BTN_STAY_TIME;
-        }
-        // decrease value
-        while(digitalRead(DOWN_BTN_PIN) == HIGH){
-            max_temperature -= interval; 
-            if(max_temperature < 0){ // value limit
-                max_temperature = 0;
+/*
+Make a button event to compare with next_button_event()
+@param int button index in buttons
+@param int type BTN_PRESS, BTN_RELEASE, BTN_LONG_PRESS or BTN_REPEAT
+*/
+int button_event(int button, int type){
+    return (button << 4) | type;
+}
+
+/*
+Turn button edges into press and release events once the buttons stayed stable for
+BTN_DEBOUNCE_TIME, and add long press and repeat events for buttons held down.
+*/
+void scan_buttons(){
+    unsigned long current_time = millis();
+#if !defined(__AVR__)
+    button_edge_pending = true; // no pin change interrupt, read buttons on every scan
+#endif
+    noInterrupts();
+    bool stable = button_edge_pending && current_time - button_edge_time >= BTN_DEBOUNCE_TIME;
+    if(stable){
+        button_edge_pending = false;
+    }
+    interrupts();
+    for (int i = 0; i < BTN_COUNT; ++i)
+    {
+        Button &button = buttons[i];
+        if(button.pin < 0){
+            continue;
+        }
+        if(stable){
+            bool level = digitalRead(button.pin) == HIGH;
+            if(level != button.pressed){
+                button.pressed = level;
+                push_button_event(i, level? BTN_PRESS : BTN_RELEASE);
+                button.press_time = current_time;
+                button.next_repeat = current_time + BTN_REPEAT_DELAY;
+                button.long_press_sent = false;
             }
-            print_message(max_temperature,column ,1,3);
-            delay(BTN_DELAY_TIME);
-            time_end = millis();
-            time_begin += BTN_STAY_TIME;
+        }
+        if(!button.pressed){
+            continue;
+        }
+        if(!button.long_press_sent && current_time - button.press_time >= BTN_LONG_PRESS_TIME){
+            button.long_press_sent = true;
+            push_button_event(i, BTN_LONG_PRESS);
+        }
+        if((long)(current_time - button.next_repeat) >= 0){
+            button.next_repeat += BTN_REPEAT_TIME;
+            push_button_event(i, BTN_REPEAT);
         }
     }
-    }while(time_end - time_begin < BTN_STAY_TIME);
 }
 
-/* Set light intensity
-@param interval to increase/decrease with interval value
- */
-void set_light_intensity(int interval){
-    String row_1_msg = "LIGHT INTENSITY";
-    String row_2_msg = "Percent:";
-    int column = row_2_msg.length();
-    print_message(row_1_msg ,row_2_msg + String(max_light_intensity),0,true); // Print stored value
-    // increase value
-    lcd.cursor();
-    unsigned long time_begin = millis();;
-    unsigned long time_end = 0;
-    do{
-        while(digitalRead(UP_BTN_PIN) == HIGH){
-            max_light_intensity += interval; 
-            if(max_light_intensity > 100){ // value limit
-                max_light_intensity = 100;
-            }
-            print_message(max_light_intensity, column,1,3);
-            delay(BTN_DELAY_TIME);
-            time_end = millis();
-            time_begin += BTN_STAY_TIME;
-        }
-        // decrease value
-        while(digitalRead(DOWN_BTN_PIN) == HIGH){
-            max_light_intensity -= interval;
-            if(max_light_intensity < 0){ // value limit
-                max_light_intensity = 0;
-            }
-            print_message(max_light_intensity,column ,1,3);
-            delay(BTN_DELAY_TIME);
-            time_end = millis();
-            time_begin += BTN_STAY_TIME;
+/* Enable pin change interrupt on every button */
+void start_buttons(){
+#if defined(__AVR__)
+    for (int i = 0; i < BTN_COUNT; ++i)
+    {
+        if(buttons[i].pin < 0){
+            continue;
         }
-    }while(time_end - time_begin < BTN_STAY_TIME);
-
-    lcd.noCursor();
+        *digitalPinToPCICR(buttons[i].pin) |= _BV(digitalPinToPCICRbit(buttons[i].pin));
+        *digitalPinToPCMSK(buttons[i].pin) |= _BV(digitalPinToPCMSKbit(buttons[i].pin));
+    }
+#endif
 }
 
-/* Set the gap between the surface/object and the lamp's arm.
-@param interval to increase/decrease with interval value
- */
-void set_distance_gap(int interval){
-    String row_1_msg = "GAP FROM OBJECT";
-    String row_2_msg = "Gap IN CM:";
-    int column = row_2_msg.length();
-    print_message(row_1_msg ,row_2_msg + String(distance_gap),0,true); // print stored values
-    lcd.cursor();
-    unsigned long time_begin = millis();;
-    unsigned long time_end = 0;
-    do{
-        // increase value when btn is high
-        while(digitalRead(UP_BTN_PIN) == HIGH){
-            distance_gap += interval;
-            if(distance_gap > 100){ // value limit
-                distance_gap = 100;
-            } 
-            print_message(distance_gap, column,1,3);
-            delay(BTN_DELAY_TIME);
-            time_end = millis();
-            time_begin += BTN_STAY_TIME;
-        }
-        // decrease value when btn is high
-        while(digitalRead(DOWN_BTN_PIN) == HIGH){
-            distance_gap -= interval; 
-            if(distance_gap < 0){ // value limit
-                distance_gap = 0;
-            }
-            print_message(distance_gap,column ,1,3);
-            delay(BTN_DELAY_TIME);
-            time_end = millis();
-            time_begin += BTN_STAY_TIME;
+/*========== Sensor filters =============*/
+// Controls never see a raw sample: implausible samples are rejected, a running median
+// drops spikes and an integer EMA smooths what is left. Memory is fixed per sensor.
+
+const int FILTER_WINDOW = 5; // samples in the running median, odd
+const int FILTER_FAULT_SAMPLES = 5; // rejected samples in a row before a sensor counts as faulty
+
+/* Plausible range and smoothing of a sensor, the tables below are kept in flash */
+struct FilterLimits {
+    int low; // lowest plausible sample
+    int high;
+    uint8_t ema_shift; // a new median weighs 1/2^ema_shift in the EMA, at most 4 so it fits an int
+    uint8_t stuck_samples; // samples without a change of 1 while one is expected, 0 for no check
+};
+
+/* Filter state of a sensor */
+struct SensorFilter {
+    int window[FILTER_WINDOW]; // last samples in arrival order
+    int sorted[FILTER_WINDOW]; // the same samples sorted, median is in the middle
+    uint8_t head; // oldest sample in window once it is full
+    uint8_t count; // samples in window
+    int ema; // filtered value scaled by 2^ema_shift
+    int stuck_value; // filtered value when a change was last seen
+    uint8_t stuck_count;
+    uint8_t rejected; // implausible samples in a row
+    bool fault; // FILTER_FAULT_SAMPLES rejected in a row, cleared by the next plausible sample
+    bool stuck; // value did not change while a change was expected
+};
+
+// Echoes in cm, the arm counts as stalled after 50 pings (3s) without moving a cm while driven
+const FilterLimits DISTANCE_FILTER_LIMITS PROGMEM = {2, MAX_DISTANCE, 1, 50};
+// Same order as ADC_CHANNEL_PINS, raw 10 bit readings
+const FilterLimits ADC_FILTER_LIMITS[ADC_CHANNEL_COUNT] PROGMEM = {
+    {20, 358, 2, 0}, // TMP36 from -40 to 125 Celsius
+    {0, 1023, 2, 0}, // light sensor reads 0 in the dark
+    {1, 1023, 2, 0}, // soil sensor reads 0 only when it is not connected
+};
+
+SensorFilter distance_filter;
+SensorFilter adc_filters[ADC_FILTER_COUNT]; // one per channel, the soil channel has one per zone
+
+/*
+Feed a sample to a sensor filter. The oldest sample leaves the sorted window and
+the new one is moved into place, at most FILTER_WINDOW steps for every sample.
+@param SensorFilter& filter filter of the sensor
+@param const FilterLimits* limits_P limits of the sensor in flash
+@param int sample raw sample, anything out of limits is rejected
+@param bool expect_change true while an actuator should be changing the value, for stuck check
+@return bool false when the sample was rejected
+*/
+bool filter_push(SensorFilter& filter, const FilterLimits* limits_P, int sample, bool expect_change){
+    FilterLimits limits;
+    memcpy_P(&limits, limits_P, sizeof(limits));
+    if(sample < limits.low || sample > limits.high){
+        if(filter.rejected < FILTER_FAULT_SAMPLES && ++filter.rejected == FILTER_FAULT_SAMPLES){
+            filter.fault = true;
         }
-    }while(time_end - time_begin < BTN_STAY_TIME);
+        return false;
+    }
+    filter.rejected = 0;
+    filter.fault = false;
+
+    int i;
+    if(filter.count < FILTER_WINDOW){
+        i = filter.count++;
+    }else{
+        int oldest = filter.window[filter.head];
+        for (i = 0; filter.sorted[i] != oldest; ++i);
+    }
+    while(i > 0 && filter.sorted[i - 1] > sample){
+        filter.sorted[i] = filter.sorted[i - 1];
+        --i;
+    }
+    while(i < filter.count - 1 && filter.sorted[i + 1] < sample){
+        filter.sorted[i] = filter.sorted[i + 1];
+        ++i;
+    }
+    filter.sorted[i] = sample;
+    filter.window[filter.head] = sample;
+    filter.head = (filter.head + 1) % FILTER_WINDOW;
 
-    lcd.noCursor();
+    int median = filter.sorted[(filter.count - 1) / 2];
+    if(filter.count == 1){
+        filter.ema = median << limits.ema_shift;
+    }else{
+        // settles exactly on the median, ema >> ema_shift never lags it by a rounding step
+        filter.ema += median - (filter.ema >> limits.ema_shift);
+    }
+
+    int value = filter.ema >> limits.ema_shift;
+    if(!expect_change || abs(value - filter.stuck_value) >= 1){
+        filter.stuck_value = value;
+        filter.stuck_count = 0;
+        filter.stuck = false;
+    }else if(limits.stuck_samples > 0 && filter.stuck_count < limits.stuck_samples
+             && ++filter.stuck_count == limits.stuck_samples){
+        filter.stuck = true;
+    }
+    return true;
 }
 
-/* set soil moisture level
-@param interval to increase/decrease with interval value
- */
-void set_soil_moisture_level(int interval){
-    String row_1_msg = "SOIL MOISTURE %";
-    String row_2_msg = "Percent:";
-    int column = row_2_msg.length();
-    print_message(row_1_msg ,row_2_msg + String(min_soil_moinstrure),0,true); // print stored values
-    lcd.cursor();
-    unsigned long time_begin = millis();;
-    unsigned long time_end = 0;
-    do{
-        // increase value when btn is high
-        while(digitalRead(UP_BTN_PIN) == HIGH){
-            min_soil_moinstrure += interval; 
-            if(min_soil_moinstrure > 100){ // value limit
-                min_soil_moinstrure = 100;
-            }
-            print_message(min_soil_moinstrure, column,1,3);
-            delay(BTN_DELAY_TIME);
-            time_end = millis();
-            time_begin += BTN_STAY_TIME;
-        }
-        // decrease value when btn is high
-        while(digitalRead(DOWN_BTN_PIN) == HIGH){
-            min_soil_moinstrure -= interval; 
-            if(min_soil_moinstrure < 0){ // value limit
-                min_soil_moinstrure = 0;
-            }
-            print_message(min_soil_moinstrure,column ,1,3);
-            delay(BTN_DELAY_TIME);
-            time_end = millis();
-            time_begin += BTN_STAY_TIME;
-        }
+/*
+Filtered value of a sensor
+@param const SensorFilter& filter filter of the sensor
+@param const FilterLimits* limits_P limits of the sensor in flash
+@return int filtered sample, 0 before the first plausible sample
+*/
+int filter_value(const SensorFilter& filter, const FilterLimits* limits_P){
+    return filter.ema >> pgm_read_byte(&limits_P->ema_shift);
+}
 
-    }while(time_end - time_begin < BTN_STAY_TIME);
-    lcd.noCursor();
+/* true when the filter has a value and its sensor is not faulty */
+bool filter_ok(const SensorFilter& filter){
+    return filter.count > 0 && !filter.fault;
 }
 
 /*
-Start DC motor to water plants every n sconds if current soil moisture less than stored value.
+Called on every change of the ultrasonic pin while waiting for an echo.
+Rising edge is the start of the echo pulse and falling edge its end.
+@param bool level pin level after the change
+@param unsigned long time micros() when the change happened
 */
-void water_plants(){
-    if(current_soil_moisture < min_soil_moinstrure && current_soil_moisture != 0){
-        digitalWrite(DC_PUMP_PIN,HIGH);
-        set_rgb_color(0,0,255); // blue color
-        if(background_process){
-            print_message("DRY SOIL! DC ON","WATERING....",200); 
-            print_message("WATERING DONE!","DC OFF...",200); 
+void echo_edge(bool level, unsigned long time){
+    if(level){
+        echo_rise_time = time;
+        echo_rised = true;
+    }else if(echo_rised){
+        echo_fall_time = time;
+        echo_done = true;
+    }
+}
+
+#if defined(__AVR__)
+// The ultrasonic pin and the buttons on port D, their changes are reported by PCINT2
+ISR(PCINT2_vect){
+    if(ping_active && !echo_done){
+        // interrupt is shared, only a change of the ultrasonic pin is an echo edge
+        bool level = FastPin<ULTRASONIC_PIN>::read();
+        if(level != echo_level){
+            echo_level = level;
+            echo_edge(level, micros());
+        }
+        if(echo_done){
+            *digitalPinToPCMSK(ULTRASONIC_PIN) &= ~_BV(digitalPinToPCMSKbit(ULTRASONIC_PIN)); // ignore later edges
         }
-        digitalWrite(DC_PUMP_PIN,LOW);
-        delay(100);
     }
+    // echo edges must not restart the debounce, only a change of a button level is a button edge
+    static uint8_t button_levels = 0;
+    uint8_t levels = PIND & PORT_D_BUTTONS;
+    if(levels != button_levels){
+        button_levels = levels;
+        button_edge();
+    }
+}
+
+// Buttons on port B
+ISR(PCINT0_vect){
+    button_edge();
 }
+#endif
 
 /*
-if the distance between the object and lamp arm is smaller/bigger than defined gap 
-start DC motor to increase/decrease the distance between the object and lamp arm
-@param int error_tolerance how much in cm +- more or less than current distance 
+Send a ping from ultra sonic distance's sensor, one pin for both trigger and echo.
+The echo is timed in background and picked up by read_distance().
 */
-void keep_gap(int error_tolerance){
-   /* if(current_distance  < distance_gap - error_tolerance){
-        set_rgb_color(255,0,0); // red color for extreme warning
-        print_message("WARNIGN!!","PLANTS NEAR ARM");
-    }*/
-    if(current_distance  < distance_gap - error_tolerance){
-        digitalWrite(DC_INPUT1_PIN,HIGH);
-        digitalWrite(DC_INPUT2_PIN,LOW);
-        analogWrite(DC_PWM,255);
-        if(background_process)
-            print_message("LIFTING UP DIST","DC ON....",300); 
-    }else if(current_distance  > distance_gap + error_tolerance){
-        digitalWrite(DC_INPUT1_PIN,LOW);
-        digitalWrite(DC_INPUT2_PIN,HIGH);
-        analogWrite(DC_PWM,255);
-        if(background_process)
-            print_message("SINKING DOWN DIST","DC ON....",300); 
-    }else{ // turn off dc motor
-        digitalWrite(DC_INPUT1_PIN,LOW);
-        digitalWrite(DC_INPUT2_PIN,LOW);
-        analogWrite(DC_PWM,0); 
-    }
-    delay(100);
-}
-
-/*
-Check light intensity if smaller than max light intensity turn on lamp, otherwise turn off lamp
+void send_ping(){
+    echo_rised = false;
+    echo_done = false;
+    ping_active = true;
+    ping_time = micros();
+    ping_millis = millis();
+    pinMode(ULTRASONIC_PIN, OUTPUT);  // Clear the trigger
+    FastPin<ULTRASONIC_PIN>::write(false);
+    delayMicroseconds(2);
+    // Sets the trigger pin to HIGH state for 10 microseconds
+    FastPin<ULTRASONIC_PIN>::write(true);
+    delayMicroseconds(10);
+    FastPin<ULTRASONIC_PIN>::write(false);
+    pinMode(ULTRASONIC_PIN, INPUT);
+    echo_level = false;
+#if defined(__AVR__)
+    // time the echo edges with pin change interrupt
+    *digitalPinToPCICR(ULTRASONIC_PIN) |= _BV(digitalPinToPCICRbit(ULTRASONIC_PIN));
+    *digitalPinToPCMSK(ULTRASONIC_PIN) |= _BV(digitalPinToPCMSKbit(ULTRASONIC_PIN));
+#else
+    // no pin change interrupt on this board, measure echo directly
+    unsigned long duration = pulseIn(ULTRASONIC_PIN, HIGH, ECHO_TIMEOUT_US);
+    if(duration > 0){
+        echo_edge(true, 0);
+        echo_edge(false, duration);
+    }
+#endif
+}
+
+/*
+Pick up the last echo and start a new ping every PING_INTERVAL.
+Echoes go through distance_filter, a missing or out of range echo is rejected by it.
+distance_valid turns false only after FILTER_FAULT_SAMPLES failed pings in a row.
 */
-void check_light(){
-    // Check light intensity if smaller than defined turn on lamp 
-    if(max_light_intensity < current_light_intensity){
-        digitalWrite(LAMP_PIN, HIGH);
-    }else{ // Turn off lamp
-        digitalWrite(LAMP_PIN,LOW);
+void read_distance(){
+    if(ping_active){
+        if(echo_done){
+            noInterrupts();
+            unsigned long duration = echo_fall_time - echo_rise_time;
+            interrupts();
+            ping_active = false;
+            // sound travel time is 0.0344 cm/microsocnd, for forward and backward divide with 2
+            int distance = (duration * Board::ECHO_CM_PER_100000_US + 50000) / 100000; // rounded
+            if(duration > ECHO_TIMEOUT_US){
+                distance = -1;
+            }
+            filter_push(distance_filter, &DISTANCE_FILTER_LIMITS, distance, lift_pwm != 0);
+            current_distance = filter_value(distance_filter, &DISTANCE_FILTER_LIMITS);
+            distance_valid = filter_ok(distance_filter);
+        }else if(micros() - ping_time > ECHO_TIMEOUT_US){
+            // no echo, stop listening
+#if defined(__AVR__)
+            *digitalPinToPCMSK(ULTRASONIC_PIN) &= ~_BV(digitalPinToPCMSKbit(ULTRASONIC_PIN));
+#endif
+            ping_active = false;
+            filter_push(distance_filter, &DISTANCE_FILTER_LIMITS, -1, lift_pwm != 0);
+            distance_valid = filter_ok(distance_filter);
+        }
+        return;
+    }
+    if(millis() - ping_millis >= PING_INTERVAL){
+        send_ping();
     }
 }
 
 /*
-Send 1KHz sound signal to buzzer sensor.
-If global variable no_bazzer is true then no signal will be sent
+Add a sample to the ADC buffer, called only from the producer side.
+When the buffer is full the sample is dropped and counted.
+@param int channel index in ADC_CHANNEL_PINS
+@param int zone of a soil sample, 0 for other channels
+@param int value 10 bit reading
 */
-void run_buzzer(){
-    if(!no_buzzer){
-        tone(BUZZER, 1000); // Send 1KHz sound signal
-    }else{
-        noTone(BUZZER); // Stop sound
+void adc_push(int channel, int zone, int value){
+    uint8_t head = adc_head;
+    uint8_t next = (head + 1) & (ADC_BUFFER_SIZE - 1);
+    if(next == adc_tail){
+        ++adc_overruns;
+        return;
     }
+    adc_buffer[head] = (channel << 13) | (zone << 10) | value;
+    adc_head = next; // publish after the sample is written
 }
 
+#if defined(__AVR__)
+// channel of the conversion in progress and of the one after it, ADMUX changes apply two conversions later
+volatile uint8_t adc_converting = 0;
+volatile uint8_t adc_queued = 0;
+volatile bool adc_scanning = false;
+uint16_t adc_sum[ADC_CHANNEL_COUNT];
+uint8_t adc_sum_count[ADC_CHANNEL_COUNT];
 
-/* turn on rgb and alert with/without buzzer when something is wrong */
-void alert(){
-    if(current_temperature > max_temperature){
-        set_rgb_color(255,0,0); // red color for extreme warning
-        run_buzzer();
-        print_message("WARNIGN!!","High TEMPERATURE");
-    }else if(current_soil_moisture == 0){
-        set_rgb_color(255,0,0); // red color for warning
-        print_message("WARNIGN!!","DRY SOIL..");
-    }else{
-        noTone(BUZZER); // Stop sound
-        // set color to green to indicate no problem
-        set_rgb_color(0,255,0);
+// ADC in free running mode during a scan, each conversion takes 13 ADC clocks (~104us at 125kHz)
+ISR(ADC_vect){
+    if(!(ADCSRA & _BV(ADATE))){
+        ADCSRA &= ~_BV(ADEN); // conversion that had started when the scan ended, nothing wakes the CPU until the next
+        adc_scanning = false;
+        return;
+    }
+    uint16_t value = ADC;
+    uint8_t channel = adc_converting;
+    adc_converting = adc_queued;
+    adc_queued = (adc_queued + 1) % ADC_CHANNEL_COUNT;
+    ADMUX = _BV(REFS0) | (ADC_CHANNEL_PINS[adc_queued] - A0); // AVcc reference like analogRead()
+    adc_sum[channel] += value;
+    if(++adc_sum_count[channel] == ADC_OVERSAMPLING){
+        if(channel != ADC_SOIL_CHANNEL){
+            adc_push(channel, 0, adc_sum[channel] / ADC_OVERSAMPLING);
+        }else if(adc_zone_changed){
+            adc_zone_changed = false; // partly from the previous zone, dropped
+        }else{
+            adc_push(channel, adc_zone, adc_sum[channel] / ADC_OVERSAMPLING);
+        }
+        adc_sum[channel] = 0;
+        adc_sum_count[channel] = 0;
+        if(channel == ADC_SOIL_CHANNEL){
+            ADCSRA &= ~_BV(ADATE); // last sample of the scan
+        }
     }
 }
+#endif
+
+/* Set up the ADC for scans, analogRead() must not be used afterwards */
+void adc_start(){
+#if defined(__AVR__)
+    ADCSRB = 0; // free running
+#endif
+}
 
 /*
-Turn off/on buzzer on long press on toggle btn
-if press time between 1s turn off buzzer
-if press time more than 1s turn on buzzer
-@param unsigned long current_time
+Start a scan of the analog sensors unless one is still running, adc_drain() picks up its samples.
+Boards without the free running ADC convert every channel once at once instead.
 */
-void reset_buzzer(unsigned long current_time){
-    if(menu_option == TEMPERATURE_OPTION){
+void adc_scan(){
+#if defined(__AVR__)
+    if(adc_scanning){
         return;
     }
-    while(digitalRead(BTN_TOGGLE_PIN) == HIGH){
-        unsigned long btn_press_time = millis() - current_time; // store press time
-        // if press between 1s and 3s turn off buzzer
-        if(btn_press_time > 1000 && !no_buzzer){
-            no_buzzer = true;
-            print_message("BUZZER OFF...","");
-            noTone(BUZZER);
-            return;
-        }
-        // if press more than 3s turn on buzzer
-        if(btn_press_time > 1000){
-            no_buzzer = false;
-            // Send 1KHz sound signal to inform that buzzer is on
-            tone(BUZZER, 1000);
-            print_message("BUZZER ON...","");
-            noTone(BUZZER);
-            return;
-        }
+    for (int i = 0; i < ADC_CHANNEL_COUNT; ++i)
+    {
+        adc_sum[i] = 0;
+        adc_sum_count[i] = 0;
+    }
+    adc_converting = 0;
+    adc_queued = 0;
+    adc_zone_changed = false; // the scan starts on the zone selected now
+    adc_scanning = true;
+    ADMUX = _BV(REFS0) | (ADC_CHANNEL_PINS[0] - A0); // AVcc reference like analogRead()
+    // enable, start, auto trigger, interrupt, clock 16MHz/128
+    ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+#else
+    for (int i = 0; i < ADC_CHANNEL_COUNT; ++i)
+    {
+        adc_push(i, i == ADC_SOIL_CHANNEL ? adc_zone : 0, analogRead(ADC_CHANNEL_PINS[i]));
     }
+#endif
+    ++adc_scans;
 }
 
-/*Print menu options*/
-void menu(){
-    // on menu click move to next menu option
-    if(menu_btn_state){
-        ++menu_option;
+/* Move samples from ADC buffer to the sensor filters, never waits for a conversion */
+void adc_drain(){
+    uint8_t tail = adc_tail;
+    while(tail != adc_head){
+        uint16_t sample = adc_buffer[tail];
+        int channel = sample >> 13;
+        int zone = (sample >> 10) & 7;
+        filter_push(adc_filters[channel + zone], &ADC_FILTER_LIMITS[channel], sample & 0x3FF, false);
+        tail = (tail + 1) & (ADC_BUFFER_SIZE - 1);
     }
-    // clear lcd when moving to another menu option
-    if(menu_option != prev_option){
-        lcd.clear();
-        prev_option = menu_option;
+    adc_tail = tail; // free the slots after they are read
+}
+
+/* true when every analog sensor has a filtered value or is known to be faulty */
+bool adc_ready(){
+    for (int i = 0; i < ADC_FILTER_COUNT; ++i)
+    {
+        if(adc_filters[i].count == 0 && !adc_filters[i].fault){
+            return false;
+        }
     }
-    int interval = 5;
-    background_process = false;
-    switch (menu_option) {
-        case HOME_OPTION:
-            print_sensors_values();
-            break;
-        case TEMPERATURE_OPTION:
-            set_temperature_interval(interval);
-            break;
-        case LIGHT_OPTION:
-            set_light_intensity(interval);
-            break;
-        case DISTANCE_OPTION:
-            set_distance_gap(interval);
-            break;
-        case SOIL_OPTION:
-            set_soil_moisture_level(interval);
-            break;
-        case BACKGROUND_OPTION:
-            background_process = true;
-            print_message("BACKGROUANDS","OPERATIONS ");
-            break;
-        default:
-            menu_option = -1; // rest menu options
-            break;
+    return true;
+}
+
+/*
+Filtered reading of an analog sensor
+@param int pin analog pin of the sensor
+@param int zone soil sensor of this zone, 0 for other sensors
+@return int reading 0-1023
+*/
+int adc_read(int pin, int zone = 0){
+    for (int i = 0; i < ADC_CHANNEL_COUNT; ++i)
+    {
+        if(ADC_CHANNEL_PINS[i] == pin){
+            return filter_value(adc_filters[i + zone], &ADC_FILTER_LIMITS[i]);
+        }
     }
+    return 0;
 }
 
-void setup() {
-    // set up the LCD's number of columns and rows:
-    lcd.begin(16, 2);
+/*
+Check an analog sensor
+@param int pin analog pin of the sensor
+@param int zone soil sensor of this zone, 0 for other sensors
+@return bool true when the sensor gives plausible samples
+*/
+bool adc_ok(int pin, int zone = 0){
+    for (int i = 0; i < ADC_CHANNEL_COUNT; ++i)
+    {
+        if(ADC_CHANNEL_PINS[i] == pin){
+            return filter_ok(adc_filters[i + zone]);
+        }
+    }
+    return false;
+}
 
-    // Set RGB pins mode
-    pinMode(RED_RGB_PIN, OUTPUT);
-    pinMode(BLUE_RGB_PIN, OUTPUT);
-    pinMode(GREEN_RGB_PIN, OUTPUT);
+/*========== Zones =============*/
+// With more than one zone a chain of 74HC595 shift registers on the former RGB pins drives
+// the RGB led (on/off only), the select inputs of a CD4051 multiplexer that puts the soil
+// sensor of one zone on SOIL_MOISTURE_PIN, and a pump per zone. zone_task() moves the
+// multiplexer to the next zone every ZONE_DWELL_TIME, so every zone is sensed once per
+// ZONE_COUNT * ZONE_DWELL_TIME and the work per loop() pass stays the same for any count.
 
-    // Set buzzer pin mode
-    pinMode(BUZZER, OUTPUT);
+static_assert(ZONE_COUNT >= 1 && ZONE_COUNT <= 8, "the multiplexer has 8 inputs");
 
-    // Set light sensor pin mode
-    pinMode(LIGHT_SENSOR_PIN,INPUT);
-    pinMode(LAMP_PIN,OUTPUT);
+const unsigned long ZONE_DWELL_TIME = 60; // ms the multiplexer stays on a zone, 3 scans of which the first is dropped
+const int SHIFT_SELECT_BIT = 0; // multiplexer select inputs S0-S2 on outputs 0-2
+const int SHIFT_RED_BIT = 3;
+const int SHIFT_GREEN_BIT = 4;
+const int SHIFT_BLUE_BIT = 5;
+const int SHIFT_PUMP_BIT = 6; // pump of zone 0, the others follow
+const int SHIFT_REGISTER_COUNT = (SHIFT_PUMP_BIT + ZONE_COUNT + 7) / 8;
+uint16_t shift_outputs = 0; // last levels sent to the shift registers
+
+/* Send shift_outputs to the registers, last register first, highest bit first */
+void shift_send(){
+    FastPin<SHIFT_LATCH_PIN>::write(false);
+    for (int bit = SHIFT_REGISTER_COUNT * 8 - 1; bit >= 0; --bit)
+    {
+        FastPin<SHIFT_DATA_PIN>::write((shift_outputs >> bit) & 1);
+        FastPin<SHIFT_CLOCK_PIN>::write(true);
+        FastPin<SHIFT_CLOCK_PIN>::write(false);
+    }
+    FastPin<SHIFT_LATCH_PIN>::write(true); // outputs change together
+}
+
+/*
+Set one shift register output, only a change is sent
+@param int bit SHIFT_*_BIT
+@param bool on
+*/
+void shift_write(int bit, bool on){
+    uint16_t outputs = on ? shift_outputs | (1U << bit) : shift_outputs & ~(1U << bit);
+    if(outputs != shift_outputs){
+        shift_outputs = outputs;
+        shift_send();
+    }
+}
+
+/*
+Put the soil sensor of a zone on SOIL_MOISTURE_PIN
+@param int zone
+*/
+void select_zone_sensor(int zone){
+    shift_outputs = (shift_outputs & ~(7U << SHIFT_SELECT_BIT)) | (zone << SHIFT_SELECT_BIT);
+    shift_send();
+    adc_zone_changed = true;
+    adc_zone = zone;
+}
+
+// Every pump and the lift motor are switched on only while the safety supervisor allows, see "Safety"
+const int SAFETY_LIFT = ZONE_COUNT; // actuator index of the lift motor, a pump has the index of its zone
+const int SAFETY_ACTUATORS = ZONE_COUNT + 1;
+void safety_start();
+bool safety_allow(int actuator, bool on);
+bool safety_held(int actuator);
+
+/* Open or close the pump of a zone, stays closed while the safety supervisor holds it */
+void set_pump(int zone, bool on){
+    on = safety_allow(zone, on);
+    if(ZONE_COUNT > 1){
+        shift_write(SHIFT_PUMP_BIT + zone, on);
+    }else{
+        FastPin<DC_PUMP_PIN>::write(on);
+    }
+}
+
+/* Number of pumps open now */
+int pumps_running(){
+    int count = 0;
+    for (int zone = 0; zone < ZONE_COUNT; ++zone)
+    {
+        count += pump_running[zone];
+    }
+    return count;
+}
+
+/* true when the soil sensor of every zone gives plausible samples */
+bool soil_sensors_ok(){
+    for (int zone = 0; zone < ZONE_COUNT; ++zone)
+    {
+        if(!soil_sensor_ok[zone]){
+            return false;
+        }
+    }
+    return true;
+}
+
+/* true when watering stopped in any zone because doses never reached the sensor */
+bool water_faults(){
+    for (int zone = 0; zone < ZONE_COUNT; ++zone)
+    {
+        if(water_fault[zone]){
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Default setpoint and watering state of every zone, outputs off */
+void zones_start(){
+    for (int zone = 0; zone < ZONE_COUNT; ++zone)
+    {
+        min_soil_moinstrure[zone] = DEFAULT_SOIL_MOISTURE;
+        water_state[zone] = WATER_IDLE;
+        water_gain[zone] = WATER_START_GAIN;
+    }
+    if(ZONE_COUNT > 1){
+        pinMode(SHIFT_DATA_PIN, OUTPUT);
+        pinMode(SHIFT_CLOCK_PIN, OUTPUT);
+        pinMode(SHIFT_LATCH_PIN, OUTPUT);
+        select_zone_sensor(0);
+    }
+}
+
+/*========== Sensor conversion =============*/
+// No FPU on the board, readings are converted with integer multiply and shift.
+// Scale factors are computed at compile time from the calibration constants.
+
+const int ADC_CODES = 1024; // 10 bit ADC
+
+/*
+Convert reading to percent of the highest reading the sensor gives.
+reading * 100 / FULL_SCALE, truncated like the int conversion of the float formula.
+*/
+template <long FULL_SCALE>
+struct PercentScale {
+    // error of the rounded up factor stays below 1/FULL_SCALE for every code, so truncation is exact
+    static constexpr int SHIFT = 20;
+    static constexpr unsigned long FACTOR = ((100UL << SHIFT) + FULL_SCALE - 1) / FULL_SCALE;
+    static constexpr unsigned long TENTHS_FACTOR = ((1000UL << SHIFT) + FULL_SCALE - 1) / FULL_SCALE;
+
+    static constexpr int convert(int reading){
+        return ((unsigned long)reading * FACTOR) >> SHIFT;
+    }
+
+    // tenths of percent, truncated
+    static constexpr int convert_tenths(int reading){
+        return ((unsigned long)reading * TENTHS_FACTOR) >> SHIFT;
+    }
+
+    static constexpr int exact(int reading){
+        return (long)reading * 100 / FULL_SCALE;
+    }
+
+    static constexpr int exact_tenths(int reading){
+        return (long)reading * 1000 / FULL_SCALE;
+    }
+};
+
+/* Tenths of a PercentScale seen as a scale of their own, for scale_is_exact() */
+template <class Scale>
+struct TenthsScale {
+    static constexpr int convert(int reading){
+        return Scale::convert_tenths(reading);
+    }
+
+    static constexpr int exact(int reading){
+        return Scale::exact_tenths(reading);
+    }
+};
+
+/*
+Convert reading of an analog temperature sensor to Celsius, rounded half away from zero.
+@tparam VREF_MV ADC reference voltage in millivolts
+@tparam OFFSET_MV sensor output at 0 Celsius
+@tparam MV_PER_DEGREE sensor output change per Celsius
+*/
+template <long VREF_MV, long OFFSET_MV, long MV_PER_DEGREE>
+struct TemperatureScale {
+    // Celsius in 16.16 fixed point: reading * SLOPE - OFFSET
+    static constexpr int SHIFT = 16;
+    static constexpr long SLOPE = (VREF_MV << SHIFT) / (ADC_CODES * MV_PER_DEGREE);
+    static constexpr long OFFSET = (OFFSET_MV << SHIFT) / MV_PER_DEGREE;
+    static constexpr long HALF = 1L << (SHIFT - 1);
+
+    static constexpr int convert(int reading){
+        return round_fixed((long)reading * SLOPE - OFFSET);
+    }
+
+    static constexpr int round_fixed(long value){
+        return (value >= 0)? (int)((value + HALF) >> SHIFT) : -(int)((HALF - value) >> SHIFT);
+    }
+
+    static constexpr int exact(int reading){
+        return round_ratio((long)reading * VREF_MV - OFFSET_MV * ADC_CODES, ADC_CODES * MV_PER_DEGREE);
+    }
+
+    static constexpr int round_ratio(long value, long divisor){
+        return (value >= 0)? (int)((2 * value + divisor) / (2 * divisor)) : -(int)((divisor - 2 * value) / (2 * divisor));
+    }
+};
+
+/*
+true when Scale::convert() gives the same value as Scale::exact() for every reading from first to last - 1.
+Halves the range on each call so compile time recursion stays shallow.
+*/
+template <class Scale>
+constexpr bool scale_is_exact(int first, int last){
+    return (last - first == 1)? Scale::convert(first) == Scale::exact(first)
+        : scale_is_exact<Scale>(first, (first + last) / 2) && scale_is_exact<Scale>((first + last) / 2, last);
+}
+
+// TMP36: 10mV per Celsius with 500mV at 0 Celsius, against the ADC reference of the board
+typedef TemperatureScale<Board::ADC_VREF_MV, 500, 10> TemperatureSensorScale;
+// Full scale readings of the light and soil sensors of the board
+typedef PercentScale<Board::LIGHT_FULL_SCALE> LightSensorScale;
+typedef PercentScale<Board::SOIL_FULL_SCALE> SoilSensorScale;
+
+static_assert(scale_is_exact<TemperatureSensorScale>(0, ADC_CODES), "temperature scale is not exact");
+static_assert(scale_is_exact<LightSensorScale>(0, ADC_CODES), "light scale is not exact");
+static_assert(scale_is_exact<SoilSensorScale>(0, ADC_CODES), "soil moisture scale is not exact");
+static_assert(scale_is_exact<TenthsScale<SoilSensorScale>>(0, ADC_CODES), "soil moisture tenths are not exact");
+
+/*
+Read temperature's sensor value
+@return int temperature in celcuis
+*/
+int read_temperature(int temperature_sensor_pin){
+    // Convert the reading from the TMP36 into the temperature in Celsius and return it
+    return TemperatureSensorScale::convert(adc_read(temperature_sensor_pin));
+}
+
+/*
+Read light intensity sensor
+@return int light intensity in percent
+*/
+int read_light_intensity(){
+    return LightSensorScale::convert(adc_read(LIGHT_SENSOR_PIN));
+}
+
+/*
+Read soil moisture sensor
+@param int zone
+@return int soil moisture in percent
+*/
+int read_soil_moisture(int zone){
+    return SoilSensorScale::convert(adc_read(SOIL_MOISTURE_PIN, zone));
+}
+
+/*
+Read soil moisture sensor with more resolution
+@param int zone
+@return int soil moisture in tenths of percent
+*/
+int read_soil_moisture_tenths(int zone){
+    return SoilSensorScale::convert_tenths(adc_read(SOIL_MOISTURE_PIN, zone));
+}
+
+/*Print current sensor's values, prints the following:
+DI: Distance in cm
+TE: Temperature in celcuis
+LI: light intensity
+SM: soil moisture, S1: to S8: of the selected zone with more than one zone
+*/
+void print_sensors_values(){
+    screen.setCursor(0,0);
+    screen.print(F("DI:"));
+    screen.print(current_distance);
+    screen.print(F("CM,"));
+
+    screen.print(F("TE:"));
+    screen.print(current_temperature);
+    screen.print(F("  "));
+
+    screen.setCursor(0,1);
+    screen.print(F("LT:"));
+    screen.print(current_light_intensity);
+    screen.print(F(","));
+    if(ZONE_COUNT > 1){
+        screen.print('S');
+        screen.print(selected_zone + 1);
+        screen.print(':');
+    }else{
+        screen.print(F("SM:"));
+    }
+    screen.print(current_soil_moisture[selected_zone]);
+    screen.print(F("  "));
+}
+
+/* Write one color of the RGB led, pins without PWM (11 loses it to tone()) are only on or off
+@param int value 0 to 255
+ */
+template <int PIN>
+void write_rgb_pin(int value){
+    if(pin_has_pwm(PIN)){
+        analogWrite(PIN, value);
+    }else{
+        FastPin<PIN>::write(value > 127);
+    }
+}
+
+/* Set RGB colors
+@param int red
+@param int green
+@param int blue
+ */
+void set_rgb_color(int red_value,int green_value,int blue_value)
+{
+#if ZONE_COUNT > 1
+    // led is on the shift register, any value turns a color fully on
+    shift_write(SHIFT_RED_BIT, red_value > 0);
+    shift_write(SHIFT_GREEN_BIT, green_value > 0);
+    shift_write(SHIFT_BLUE_BIT, blue_value > 0);
+#else
+    write_rgb_pin<RED_RGB_PIN>(red_value);
+    write_rgb_pin<GREEN_RGB_PIN>(green_value);
+    write_rgb_pin<BLUE_RGB_PIN>(blue_value);
+#endif
+}
+
+/* Open the pump of a zone for a dose of ms milliseconds, stop_pump() closes it */
+void start_pump(int zone, unsigned long ms){
+    set_pump(zone, true);
+    pump_running[zone] = true;
+    pump_start_time[zone] = millis();
+    if(background_process){
+        print_message(F("DRY SOIL! DC ON"),F("WATERING...."),ms); 
+    }
+}
+
+/* Close the pump of a zone when the dose of ms milliseconds is over */
+void stop_pump(int zone, unsigned long ms){
+    if(pump_running[zone] && millis() - pump_start_time[zone] >= ms){
+        set_pump(zone, false);
+        pump_running[zone] = false;
+        if(background_process){
+            print_message(F("WATERING DONE!"),F("DC OFF..."),200); 
+        }
+    }
+}
+
+#if PULSE_WATERING
+/*
+Start DC motor to water plants every n sconds if current soil moisture less than stored value.
+The pump is closed again by stop_pump() after PUMP_PULSE_TIME.
+@param int zone
+*/
+void water_plants(int zone){
+    if(soil_sensor_ok[zone] && current_soil_moisture[zone] < min_soil_moinstrure[zone]
+       && pumps_running() < PUMPS_AT_ONCE){
+        start_pump(zone, PUMP_PULSE_TIME);
+    }
+}
+#else
+/*
+Water in doses sized from how the soil answered earlier ones. When moisture drops below
+min_soil_moinstrure a dose aims WATER_HYSTERESIS above it using the learned gain, then no
+more water is given until the sensor shows the dose has soaked in: moisture rose and then
+rose less than WATER_SOAKED_RISE between two checks. The rise gives the next gain and the
+time to the first rise the response delay, which also spaces the checks for slow soil.
+Has to run often enough to close the pump on time, water_task runs it every 50ms.
+A dry zone waits while PUMPS_AT_ONCE other pumps are open.
+@param int zone
+*/
+void water_plants(int zone){
+    unsigned long now = millis();
+    int moisture = current_soil_moisture_tenths[zone];
+    int low = min_soil_moinstrure[zone] * 10;
+    if(water_state[zone] == WATER_IDLE){
+        if(water_fault[zone] && moisture >= low + WATER_HYSTERESIS){
+            water_fault[zone] = false; // watered by hand
+            water_no_response[zone] = 0;
+        }
+        if(!soil_sensor_ok[zone] || water_fault[zone] || moisture >= low || pumps_running() >= PUMPS_AT_ONCE){
+            return;
+        }
+        unsigned long dose = (unsigned long)(low + WATER_HYSTERESIS - moisture) * 1000 / water_gain[zone];
+        water_dose[zone] = constrain(dose, WATER_MIN_DOSE, WATER_MAX_DOSE);
+        water_start_moisture[zone] = moisture;
+        water_state[zone] = WATER_DOSING;
+        start_pump(zone, water_dose[zone]);
+    }else if(water_state[zone] == WATER_DOSING){
+        stop_pump(zone, water_dose[zone]);
+        if(!pump_running[zone]){
+            water_state[zone] = WATER_SOAKING;
+            water_rise_time[zone] = 0;
+            water_check_moisture[zone] = moisture;
+            water_check_time[zone] = now;
+        }
+    }else{
+        if(water_rise_time[zone] == 0 && moisture - water_start_moisture[zone] >= WATER_SOAKED_RISE){
+            water_rise_time[zone] = now;
+        }
+        if(now - water_check_time[zone] < max(WATER_SLOPE_TIME, water_delay[zone])){
+            return;
+        }
+        int check_rise = moisture - water_check_moisture[zone];
+        water_check_moisture[zone] = moisture;
+        water_check_time[zone] = now;
+        if(water_rise_time[zone] != 0 && check_rise < WATER_SOAKED_RISE){
+            long gain = (long)(moisture - water_start_moisture[zone]) * 1000 / water_dose[zone];
+            water_gain[zone] = constrain((water_gain[zone] + gain + 1) / 2, WATER_MIN_GAIN, WATER_MAX_GAIN);
+            water_delay[zone] = water_rise_time[zone] - pump_start_time[zone];
+            water_no_response[zone] = 0;
+            water_state[zone] = WATER_IDLE;
+        }else if(water_rise_time[zone] == 0 && now - pump_start_time[zone] > WATER_MAX_SOAK){
+            if(++water_no_response[zone] >= WATER_NO_RESPONSE_LIMIT){
+                water_fault[zone] = true;
+            }
+            water_state[zone] = WATER_IDLE;
+        }
+    }
+}
+#endif
+
+/*
+Drive the lift motor, positive duty lifts the arm up and negative sinks it down, stays stopped while
+the safety supervisor holds it
+@param int pwm signed duty -255..255
+*/
+void drive_lift(int pwm){
+    if(!safety_allow(SAFETY_LIFT, pwm != 0)){
+        pwm = 0;
+    }
+    FastPin<DC_INPUT1_PIN>::write(pwm > 0);
+    FastPin<DC_INPUT2_PIN>::write(pwm < 0);
+    analogWrite(DC_PWM,abs(pwm));
+}
+
+/* Stop the arm after a stall or timeout and leave it resting for LIFT_RETRY_TIME */
+void lift_failed(const __FlashStringHelper* reason){
+    lift_fault = true;
+    lift_fault_time = millis();
+    lift_correcting = false;
+    lift_integral = 0;
+    lift_pwm = 0;
+    drive_lift(0);
+    if(background_process){
+        print_message(F("LIFT STOPPED"),reason,1000);
+    }
+}
+
+/*
+if the distance between the object and lamp arm is smaller/bigger than defined gap 
+move the lamp arm back to the gap with a PI controller on the lift motor.
+A correction starts when the arm is more than error_tolerance off the gap and ends within LIFT_DEADBAND,
+the duty ramps by LIFT_RAMP per tick and stays between LIFT_MIN_PWM and LIFT_MAX_PWM while moving.
+Has to run every 1/LIFT_TICKS_PER_S second.
+@param int error_tolerance how much in cm +- more or less than current distance 
+*/
+void keep_gap(int error_tolerance){
+    unsigned long now = millis();
+    int target = 0;
+    if(lift_fault && now - lift_fault_time >= LIFT_RETRY_TIME){
+        lift_fault = false;
+    }
+    int error = distance_gap - current_distance; // positive when arm is too close
+    if(lift_fault){
+        lift_correcting = false;
+        lift_integral = 0;
+    }else if(!distance_valid){
+        // no echo, do not move arm blindly but keep the correction going for the next echo
+    }else if(!lift_correcting && abs(error) > error_tolerance){
+        lift_correcting = true;
+        lift_integral = 0;
+        lift_start_time = now;
+    }else if(lift_correcting && abs(error) <= LIFT_DEADBAND){
+        lift_correcting = false;
+        lift_integral = 0;
+    }
+    if(lift_correcting && distance_valid){
+        if(distance_filter.stuck){
+            lift_failed(F("ARM STALLED"));
+            return;
+        }
+        if(now - lift_start_time > LIFT_TIMEOUT){
+            lift_failed(F("GAP TIMEOUT"));
+            return;
+        }
+        long output = (long)LIFT_KP * error + lift_integral * LIFT_KI / LIFT_TICKS_PER_S;
+        // anti-windup, only integrate while the output is not saturated or the error pulls it back
+        if(abs(output) < LIFT_MAX_PWM || (output > 0) != (error > 0)){
+            lift_integral += error;
+        }
+        output = constrain(output, -LIFT_MAX_PWM, LIFT_MAX_PWM);
+        if(abs(output) < LIFT_MIN_PWM){
+            output = error > 0 ? LIFT_MIN_PWM : -LIFT_MIN_PWM;
+        }
+        target = output;
+    }
+    // ramp duty towards target, reversing passes through zero
+    lift_pwm += constrain(target - lift_pwm, -LIFT_RAMP, LIFT_RAMP);
+    if(lift_pwm != 0 && abs(lift_pwm) < LIFT_MIN_PWM && target != 0 && (lift_pwm > 0) == (target > 0)){
+        lift_pwm = target > 0 ? max(lift_pwm, LIFT_MIN_PWM) : min(lift_pwm, -LIFT_MIN_PWM);
+    }
+    drive_lift(lift_pwm);
+    // messages are only printed when the motor changes direction, gap task runs several times a second
+    int direction = lift_pwm > 0 ? 1 : (lift_pwm < 0 ? -1 : 0);
+    if(background_process && direction != 0 && direction != lift_direction){
+        if(direction > 0)
+            print_message(F("LIFTING UP DIST"),F("DC ON...."),300); 
+        else
+            print_message(F("SINKING DOWN DIST"),F("DC ON...."),300); 
+    }
+    lift_direction = direction;
+}
+
+/* Light the sensor would see without the lamp, percent */
+int ambient_light(){
+    return current_light_intensity - (long)lamp_gain * lamp_duty / 255;
+}
+
+/* Duty that makes up for missing percent of light with the learned lamp gain */
+int lamp_dim_duty(int missing){
+    return constrain((long)missing * 255 / lamp_gain, LAMP_MIN_DUTY, 255);
+}
+
+/*
+Set the lamp duty, a change of at least LAMP_LEARN_DUTY is measured at the sensor once it settled
+@param int duty 0-255
+*/
+void set_lamp(int duty){
+    if(duty == lamp_duty){
+        return;
+    }
+    unsigned long now = millis();
+    if((duty > 0) != (lamp_duty > 0)){
+        ++lamp_switches;
+        lamp_switch_time = now;
+    }
+    if(abs(duty - lamp_duty) >= LAMP_LEARN_DUTY){
+        lamp_learn_light = current_light_intensity;
+        lamp_learn_duty = duty - lamp_duty;
+    }
+    lamp_duty = duty;
+    lamp_change_time = now;
+    lamp_on = duty > 0;
+    if(LAMP_DIMMING){
+        analogWrite(LAMP_PIN, duty);
+    }else{
+        FastPin<LAMP_PIN>::write(lamp_on);
+    }
+}
+
+/*
+Top the daylight up to max_light_intensity with the lamp. The light sensor also sees the lamp, so
+decisions go by ambient_light(), the reading less what the lamp adds, learned from how the reading
+changed at earlier switches. The lamp goes on when daylight is more than light_band below the
+setpoint and off when it is more than light_band above, and stays on for LAMP_MIN_ON_TIME and off
+for LAMP_MIN_OFF_TIME, so light around the setpoint does not make it chatter. When the lamp pin has
+PWM the duty makes up the missing light, the first time on is at full duty to learn the gain.
+*/
+void check_light(){
+    unsigned long now = millis();
+    lamp_full_ms += (now - lamp_count_time) * lamp_duty / 255;
+    lamp_count_time = now;
+    if(now - lamp_change_time < LAMP_SETTLE_TIME){
+        return; // the sensor has not seen the last change yet
+    }
+    if(lamp_learn_light >= 0){
+        int gain = (long)(current_light_intensity - lamp_learn_light) * 255 / lamp_learn_duty;
+        lamp_gain = constrain(lamp_gain == 0 ? gain : (lamp_gain + gain + 1) / 2, 0, LAMP_MAX_GAIN);
+        lamp_learn_light = -1;
+    }
+    int missing = max_light_intensity - ambient_light();
+    bool dimming = LAMP_DIMMING && lamp_gain > 0;
+    if(lamp_duty == 0){
+        if(missing > light_band && now - lamp_switch_time >= LAMP_MIN_OFF_TIME){
+            set_lamp(dimming ? lamp_dim_duty(missing) : 255);
+        }
+    }else if(missing < -light_band){
+        if(now - lamp_switch_time >= LAMP_MIN_ON_TIME){
+            set_lamp(0);
+        }
+    }else if(dimming){
+        // follow the daylight, a change of duty has to be worth half a band of light
+        int duty = lamp_dim_duty(missing);
+        if((long)abs(duty - lamp_duty) * lamp_gain >= (long)light_band * 255 / 2){
+            set_lamp(duty);
+        }
+    }
+}
+
+/*========== Alerts =============*/
+// Conditions that need the user, each a bit of alerts_active. A lower bit is more urgent: it sets
+// the led and the buzzer pattern, and its banner comes first. A condition is raised after it held
+// for raise_s and cleared after its clear condition held for clear_s, the clear condition is a bit
+// inside the raise one so a value on the edge does not flap. Alarms light the led red and warnings
+// yellow. Banners go through the lcd frame, a raise shows its banner at once and the others follow
+// in turn on the home page. A beep ends on the tone() timer, so no alert holds up a task.
+
+const int ALERT_HIGH_TEMPERATURE = 0;
+const int ALERT_NO_TEMPERATURE_SENSOR = 1;
+const int ALERT_NO_SOIL_SENSOR = 2;
+const int ALERT_WATER_FAULT = 3; // doses never reached the soil sensor, see water_plants(), or a pump is held
+const int ALERT_LIFT_FAULT = 4; // arm stalled or never reached the gap, see keep_gap(), or the motor is held
+const int ALERT_NO_ECHO = 5;
+const int ALERT_LOW_TEMPERATURE = 6;
+const int ALERT_DRY_SOIL = 7;
+const int ALERT_COUNT = 8;
+const int ALERT_TEMPERATURE_HYSTERESIS = 1; // Celsius back inside the setpoint before a temperature alert clears
+const int ALERT_DRY_MARGIN = 10; // percent below min_soil_moinstrure that is dry in spite of watering
+const unsigned long ALERT_TICK = 250; // ms, period of alert_task()
+const unsigned long ALERT_BANNER_TIME = 2000; // ms a banner stays
+const unsigned long ALERT_ROTATE_TIME = 10000; // ms from one banner to the next on the home page
+
+// Buzzer patterns, a slot is one alert_task() tick and a set bit in slots beeps in it
+const int BUZZER_SILENT = 0;
+const int BUZZER_ALARM = 1;
+const int BUZZER_FAULT = 2;
+const unsigned int BUZZER_FREQUENCY = 1000;
+const unsigned long BUZZER_BEEP_TIME = 120; // ms, shorter than a slot
+
+struct BuzzerPattern {
+    uint16_t slots; // bit 0 is the first slot
+    uint8_t cycle; // slots before the pattern repeats, the ones past 16 are silent
+};
+
+const BuzzerPattern BUZZER_PATTERNS[] PROGMEM = {
+    {0, 1},
+    {0x55, 16}, // four beeps every 4 s
+    {0x1, 240}, // a beep a minute
+};
+
+/* An alert, the table below is kept in flash */
+struct AlertInfo {
+    const char* banner; // row 2 text in flash
+    uint16_t raise_s; // the condition holds this long before the alert is raised
+    uint16_t clear_s; // the clear condition holds this long before it is cleared
+    uint8_t pattern; // BUZZER_*
+    bool warning; // yellow led, else red
+};
+
+const char HIGH_TEMPERATURE_BANNER[] PROGMEM = "HIGH TEMPERATURE";
+const char NO_TEMPERATURE_SENSOR_BANNER[] PROGMEM = "NO TEMP SENSOR";
+const char NO_SOIL_SENSOR_BANNER[] PROGMEM = "NO SOIL SENSOR";
+const char WATER_FAULT_BANNER[] PROGMEM = "CHECK WATER";
+const char LIFT_FAULT_BANNER[] PROGMEM = "LAMP ARM STUCK";
+const char NO_ECHO_BANNER[] PROGMEM = "NO DISTANCE";
+const char LOW_TEMPERATURE_BANNER[] PROGMEM = "LOW TEMPERATURE";
+const char DRY_SOIL_BANNER[] PROGMEM = "DRY SOIL";
+
+const AlertInfo ALERTS[ALERT_COUNT] PROGMEM = {
+    {HIGH_TEMPERATURE_BANNER, 10, 60, BUZZER_ALARM, false},
+    {NO_TEMPERATURE_SENSOR_BANNER, 5, 5, BUZZER_FAULT, false},
+    {NO_SOIL_SENSOR_BANNER, 5, 5, BUZZER_FAULT, false},
+    {WATER_FAULT_BANNER, 0, 5, BUZZER_FAULT, false},
+    {LIFT_FAULT_BANNER, 0, 300, BUZZER_FAULT, false}, // stays raised while the arm rests between retries
+    {NO_ECHO_BANNER, 10, 10, BUZZER_SILENT, false},
+    {LOW_TEMPERATURE_BANNER, 60, 60, BUZZER_SILENT, true},
+    {DRY_SOIL_BANNER, 1800, 60, BUZZER_SILENT, true}, // watering had half an hour to fix it
+};
+
+uint8_t alerts_active = 0; // bit per ALERT_*
+static_assert(ALERT_COUNT <= 8, "alerts do not fit alerts_active");
+uint16_t alert_ticks[ALERT_COUNT]; // ticks the condition to raise or clear the alert has held
+unsigned long alert_raises = 0; // for instrumentation
+int buzzer_pattern = BUZZER_SILENT;
+uint8_t buzzer_slot = 0;
+int alert_banner = -1; // alert whose banner was shown last
+unsigned long alert_banner_time = 0;
+bool alert_banner_due = false; // a raise shows its banner at once
+
+/* Most urgent active alert, ALERT_COUNT when there is none */
+int alert_first(uint8_t alerts){
+    int alert = 0;
+    while(alert < ALERT_COUNT && !(alerts & (1 << alert))){
+        ++alert;
+    }
+    return alert;
+}
+
+/*
+Raise or clear an alert once the change held for its time
+@param int alert ALERT_*
+@param bool raise condition to raise it
+@param bool clear condition to clear it, not raise or inside of it
+*/
+void alert_update(int alert, bool raise, bool clear){
+    AlertInfo info;
+    memcpy_P(&info, &ALERTS[alert], sizeof(AlertInfo));
+    bool active = alerts_active & (1 << alert);
+    if(!(active ? clear : raise)){
+        alert_ticks[alert] = 0;
+        return;
+    }
+    if(alert_ticks[alert] < 0xFFFF){
+        ++alert_ticks[alert];
+    }
+    if((unsigned long)alert_ticks[alert] * ALERT_TICK < (active ? info.clear_s : info.raise_s) * 1000UL){
+        return;
+    }
+    alert_ticks[alert] = 0;
+    alerts_active ^= 1 << alert;
+    if(!active){
+        ++alert_raises;
+        alert_banner = alert - 1; // next banner is this one
+        alert_banner_due = true;
+    }
+}
+
+/* Check every condition */
+void alert_conditions(){
+    alert_update(ALERT_HIGH_TEMPERATURE, temperature_sensor_ok && current_temperature > max_temperature,
+                 !temperature_sensor_ok || current_temperature <= max_temperature - ALERT_TEMPERATURE_HYSTERESIS);
+    alert_update(ALERT_LOW_TEMPERATURE, temperature_sensor_ok && current_temperature < min_temperature,
+                 !temperature_sensor_ok || current_temperature >= min_temperature + ALERT_TEMPERATURE_HYSTERESIS);
+    alert_update(ALERT_NO_TEMPERATURE_SENSOR, !temperature_sensor_ok, temperature_sensor_ok);
+    alert_update(ALERT_NO_SOIL_SENSOR, !soil_sensors_ok(), soil_sensors_ok());
+    bool pump_held = false;
+    for (int zone = 0; zone < ZONE_COUNT; ++zone)
+    {
+        pump_held = pump_held || safety_held(zone);
+    }
+    bool water = water_faults() || pump_held;
+    bool lift = lift_fault || safety_held(SAFETY_LIFT);
+    alert_update(ALERT_WATER_FAULT, water, !water);
+    alert_update(ALERT_LIFT_FAULT, lift, !lift);
+    alert_update(ALERT_NO_ECHO, !distance_valid, distance_valid);
+    bool dry = false;
+    bool moist = true;
+    for (int zone = 0; zone < ZONE_COUNT; ++zone)
+    {
+        if(soil_sensor_ok[zone] && !water_fault[zone]){ // those have alerts of their own
+            dry = dry || current_soil_moisture[zone] < min_soil_moinstrure[zone] - ALERT_DRY_MARGIN;
+            moist = moist && current_soil_moisture[zone] >= min_soil_moinstrure[zone];
+        }
+    }
+    alert_update(ALERT_DRY_SOIL, dry, moist);
+}
+
+/* Beep the slot of the pattern of the most urgent alert that has one, tone() ends the beep */
+void alert_buzzer(){
+    int pattern = BUZZER_SILENT;
+    for (int alert = 0; alert < ALERT_COUNT && pattern == BUZZER_SILENT; ++alert)
+    {
+        if(alerts_active & (1 << alert)){
+            pattern = pgm_read_byte(&ALERTS[alert].pattern);
+        }
+    }
+    if(pattern != buzzer_pattern){
+        buzzer_pattern = pattern;
+        buzzer_slot = 0;
+    }
+    BuzzerPattern beeps;
+    memcpy_P(&beeps, &BUZZER_PATTERNS[pattern], sizeof(BuzzerPattern));
+    if(!no_buzzer && buzzer_slot < 16 && (beeps.slots >> buzzer_slot) & 1){
+        tone(BUZZER, BUZZER_FREQUENCY, BUZZER_BEEP_TIME);
+    }
+    buzzer_slot = (buzzer_slot + 1) % beeps.cycle;
+}
+
+/* Show the banner of the next active alert after the last one, on a raise or in turn on the home page */
+void alert_banners(){
+    if(alerts_active == 0){
+        return;
+    }
+    unsigned long now = millis();
+    bool home = menu_option == HOME_OPTION || menu_option == BACKGROUND_OPTION;
+    if(!home || message_shown || (!alert_banner_due && now - alert_banner_time < ALERT_ROTATE_TIME)){
+        return;
+    }
+    // next active alert after the one shown last, from the most urgent again after the last
+    uint8_t after = alert_banner < 0 ? 0xFF : (uint8_t)~((2 << alert_banner) - 1);
+    int alert = alert_first(alerts_active & after);
+    if(alert == ALERT_COUNT){
+        alert = alert_first(alerts_active);
+    }
+    alert_banner = alert;
+    alert_banner_time = now;
+    alert_banner_due = false;
+    int index = 0;
+    int count = 0;
+    for (int i = 0; i < ALERT_COUNT; ++i)
+    {
+        if(alerts_active & (1 << i)){
+            ++count;
+            index += i <= alert;
+        }
+    }
+    AlertInfo info;
+    memcpy_P(&info, &ALERTS[alert], sizeof(AlertInfo));
+    print_message(F("ALERT"), (const __FlashStringHelper*)info.banner, ALERT_BANNER_TIME);
+    screen.setCursor(6,0);
+    screen.print(index);
+    screen.print('/');
+    screen.print(count);
+}
+
+/* Led, buzzer and banners of the active alerts, without one the led is blue while a pump is open */
+void alert(){
+    alert_conditions();
+    alert_buzzer();
+    alert_banners();
+    int first = alert_first(alerts_active);
+    if(first == ALERT_COUNT && pumps_running() > 0){
+        set_rgb_color(0,0,255); // blue while watering
+    }else if(first == ALERT_COUNT){
+        set_rgb_color(0,255,0); // green to indicate no problem
+    }else if(pgm_read_byte(&ALERTS[first].warning)){
+        set_rgb_color(255,255,0); // yellow for a warning
+    }else{
+        set_rgb_color(255,0,0); // red for an alarm
+    }
+}
+
+/*
+Turn off/on buzzer on long press on toggle btn, on every option
+if press time more than 1s and buzzer is on turn off buzzer
+if press time more than 1s and buzzer is off turn on buzzer
+*/
+void reset_buzzer(){
+    if(toggle_long_press){
+        no_buzzer = !no_buzzer;
+        if(no_buzzer){
+            print_message(F("BUZZER OFF..."),F(""));
+            noTone(BUZZER);
+        }else{
+            // Send short 1KHz sound signal to inform that buzzer is on
+            tone(BUZZER, 1000, 100);
+            print_message(F("BUZZER ON..."),F(""));
+        }
+    }
+}
+
+/*========== History =============*/
+// Sensor values over time in three tiers, each a ring where the newest entry replaces the oldest:
+// a sample every 5 s for the last minute and min/max/avg of each of the last 15 minutes in SRAM,
+// min/max/avg of each of the last 72 hours in EEPROM so they outlive a reset.
+// A value is packed into one byte, see HISTORY_PACKING, and a minute is 12 bytes.
+
+const int HISTORY_SENSOR_COUNT = 4;
+const int HISTORY_TEMPERATURE = 0; // sensor index in a history entry
+const int HISTORY_SOIL = 1;
+const int HISTORY_LIGHT = 2;
+const int HISTORY_DISTANCE = 3;
+const unsigned long HISTORY_SAMPLE_TIME = 5000; // ms, period of history_task()
+const int HISTORY_RAW_COUNT = 12;
+const int HISTORY_SAMPLES_PER_MINUTE = 12;
+const int HISTORY_MINUTE_COUNT = 15;
+const int HISTORY_MINUTES_PER_HOUR = 60;
+const int HISTORY_HOUR_COUNT = 72;
+const uint8_t HISTORY_NO_VALUE = 255; // sensor had no plausible value
+const int HISTORY_RAM_BUDGET = 300; // bytes of SRAM the history may take, of the 2 KB of the ATmega328P
+const int EEPROM_SIZE = 1024; // ATmega328P
+const int HISTORY_EEPROM_START = 0;
+const uint8_t HISTORY_EEPROM_MAGIC = 0xA1; // changes with the layout, older data is ignored
+// EEPROM header is magic, head and count of the hour ring, the hours follow it
+const int HISTORY_EEPROM_HOURS = HISTORY_EEPROM_START + 3;
+
+/* Value stored for a sensor is (value - offset) >> shift, limited to 0-254 */
+struct HistoryPacking {
+    int offset;
+    uint8_t shift;
+    char label[3]; // on lcd and serial
+};
+
+const HistoryPacking HISTORY_PACKING[HISTORY_SENSOR_COUNT] PROGMEM = {
+    {-40, 0, "TE"}, // -40 to 214 celcuis
+    {0, 0, "SM"}, // percent, of the first zone
+    {0, 0, "LT"},
+    {0, 1, "DI"}, // 2 cm steps up to 508 cm
+};
+
+/* Min, max and average of a minute or an hour, packed */
+struct HistoryRollup {
+    uint8_t low[HISTORY_SENSOR_COUNT];
+    uint8_t high[HISTORY_SENSOR_COUNT];
+    uint8_t average[HISTORY_SENSOR_COUNT];
+};
+
+/* Rollup being built, on packed values since packing keeps their order */
+struct HistoryAccumulator {
+    uint8_t low[HISTORY_SENSOR_COUNT];
+    uint8_t high[HISTORY_SENSOR_COUNT];
+    uint16_t sum[HISTORY_SENSOR_COUNT];
+    uint8_t count[HISTORY_SENSOR_COUNT]; // values summed, sensors without a value are left out
+};
+
+struct History {
+    uint8_t raw[HISTORY_RAW_COUNT][HISTORY_SENSOR_COUNT];
+    HistoryRollup minutes[HISTORY_MINUTE_COUNT];
+    HistoryAccumulator minute;
+    HistoryAccumulator hour;
+    HistoryRollup hour_pending; // closed hour still being written to EEPROM
+    uint8_t raw_head; // next entry to write
+    uint8_t raw_count;
+    uint8_t minute_head;
+    uint8_t minute_count;
+    uint8_t hour_head; // copy of the EEPROM header
+    uint8_t hour_count;
+    uint8_t minute_samples; // raw samples in the minute accumulator
+    uint8_t hour_minutes;
+    int8_t eeprom_step; // next byte of the pending hour to write, -1 when none
+};
+
+History history;
+
+static_assert(sizeof(History) <= HISTORY_RAM_BUDGET, "history does not fit its SRAM budget");
+static_assert(HISTORY_EEPROM_HOURS + HISTORY_HOUR_COUNT * sizeof(HistoryRollup) <= EEPROM_SIZE,
+              "history does not fit in EEPROM");
+static_assert(HISTORY_MINUTES_PER_HOUR * 254 <= 65535, "hour sum overflows");
+
+/* Copy packing of a sensor from flash */
+HistoryPacking load_packing(int sensor){
+    HistoryPacking packing;
+    memcpy_P(&packing, &HISTORY_PACKING[sensor], sizeof(HistoryPacking));
+    return packing;
+}
+
+/*
+Current value of a sensor in a byte
+@param int sensor HISTORY_TEMPERATURE...
+@return uint8_t HISTORY_NO_VALUE when the sensor is not working
+*/
+uint8_t history_pack(int sensor){
+    int value;
+    bool ok;
+    if(sensor == HISTORY_TEMPERATURE){
+        value = current_temperature;
+        ok = temperature_sensor_ok;
+    }else if(sensor == HISTORY_SOIL){
+        value = current_soil_moisture[0]; // first zone
+        ok = soil_sensor_ok[0];
+    }else if(sensor == HISTORY_LIGHT){
+        value = current_light_intensity;
+        ok = adc_ok(LIGHT_SENSOR_PIN);
+    }else{
+        value = current_distance;
+        ok = distance_valid;
+    }
+    if(!ok){
+        return HISTORY_NO_VALUE;
+    }
+    HistoryPacking packing = load_packing(sensor);
+    return constrain((value - packing.offset) >> packing.shift, 0, HISTORY_NO_VALUE - 1);
+}
+
+/* Sensor value back from its byte, only for bytes other than HISTORY_NO_VALUE */
+int history_unpack(int sensor, uint8_t packed){
+    HistoryPacking packing = load_packing(sensor);
+    return ((int)packed << packing.shift) + packing.offset;
+}
+
+/* Empty an accumulator */
+void history_clear(HistoryAccumulator& accumulator){
+    memset(accumulator.low, HISTORY_NO_VALUE, sizeof(accumulator.low));
+    memset(accumulator.high, 0, sizeof(accumulator.high));
+    memset(accumulator.sum, 0, sizeof(accumulator.sum));
+    memset(accumulator.count, 0, sizeof(accumulator.count));
+}
+
+/*
+Add one entry to an accumulator, a raw sample has the same low, high and average
+@param HistoryAccumulator& accumulator
+@param const uint8_t* low packed, per sensor
+@param const uint8_t* high
+@param const uint8_t* average
+*/
+void history_add(HistoryAccumulator& accumulator, const uint8_t* low, const uint8_t* high, const uint8_t* average){
+    for (int i = 0; i < HISTORY_SENSOR_COUNT; ++i)
+    {
+        if(average[i] == HISTORY_NO_VALUE){
+            continue;
+        }
+        accumulator.low[i] = min(accumulator.low[i], low[i]);
+        accumulator.high[i] = max(accumulator.high[i], high[i]);
+        accumulator.sum[i] += average[i];
+        ++accumulator.count[i];
+    }
+}
+
+/* Turn an accumulator into a rollup and empty it */
+void history_close(HistoryAccumulator& accumulator, HistoryRollup& rollup){
+    for (int i = 0; i < HISTORY_SENSOR_COUNT; ++i)
+    {
+        uint8_t count = accumulator.count[i];
+        rollup.low[i] = count == 0 ? HISTORY_NO_VALUE : accumulator.low[i];
+        rollup.high[i] = count == 0 ? HISTORY_NO_VALUE : accumulator.high[i];
+        rollup.average[i] = count == 0 ? HISTORY_NO_VALUE : (accumulator.sum[i] + count / 2) / count;
+    }
+    history_clear(accumulator);
+}
+
+/* Pick up hours kept in EEPROM before the last reset */
+void history_start(){
+    history_clear(history.minute);
+    history_clear(history.hour);
+    history.eeprom_step = -1;
+    if(EEPROM.read(HISTORY_EEPROM_START) == HISTORY_EEPROM_MAGIC){
+        history.hour_head = EEPROM.read(HISTORY_EEPROM_START + 1) % HISTORY_HOUR_COUNT;
+        history.hour_count = min((int)EEPROM.read(HISTORY_EEPROM_START + 2), HISTORY_HOUR_COUNT);
+    }
+}
+
+/*
+Write one byte of the pending hour to EEPROM, a write takes 3.3 ms in the background.
+A full ring first drops its oldest hour from the count, so the slot the hour goes to is outside
+the ring while it is written. Head and count take it in after the last byte and magic comes last,
+so a reset in between shows an hour less but never a half written one.
+*/
+void history_write_eeprom(){
+    const int rollup_size = sizeof(HistoryRollup);
+    int step = history.eeprom_step;
+    if(step < 0){
+        return;
+    }
+    if(step == 0){
+        if(history.hour_count == HISTORY_HOUR_COUNT){
+            --history.hour_count;
+            EEPROM.update(HISTORY_EEPROM_START + 2, history.hour_count);
+        }
+    }else if(step <= rollup_size){
+        int address = HISTORY_EEPROM_HOURS + history.hour_head * rollup_size + step - 1;
+        EEPROM.update(address, ((const uint8_t*)&history.hour_pending)[step - 1]);
+    }else if(step == rollup_size + 1){
+        history.hour_head = (history.hour_head + 1) % HISTORY_HOUR_COUNT;
+        EEPROM.update(HISTORY_EEPROM_START + 1, history.hour_head);
+    }else if(step == rollup_size + 2){
+        history.hour_count = min(history.hour_count + 1, HISTORY_HOUR_COUNT);
+        EEPROM.update(HISTORY_EEPROM_START + 2, history.hour_count);
+    }else{
+        EEPROM.update(HISTORY_EEPROM_START, HISTORY_EEPROM_MAGIC);
+        history.eeprom_step = -1;
+        return;
+    }
+    ++history.eeprom_step;
+}
+
+/* Store a sample of every sensor and roll finished minutes and hours up, O(1) per call */
+void history_sample(){
+    uint8_t* sample = history.raw[history.raw_head];
+    for (int i = 0; i < HISTORY_SENSOR_COUNT; ++i)
+    {
+        sample[i] = history_pack(i);
+    }
+    history.raw_head = (history.raw_head + 1) % HISTORY_RAW_COUNT;
+    history.raw_count = min(history.raw_count + 1, HISTORY_RAW_COUNT);
+    history_add(history.minute, sample, sample, sample);
+
+    if(++history.minute_samples == HISTORY_SAMPLES_PER_MINUTE){
+        history.minute_samples = 0;
+        HistoryRollup& minute = history.minutes[history.minute_head];
+        history_close(history.minute, minute);
+        history.minute_head = (history.minute_head + 1) % HISTORY_MINUTE_COUNT;
+        history.minute_count = min(history.minute_count + 1, HISTORY_MINUTE_COUNT);
+        history_add(history.hour, minute.low, minute.high, minute.average);
+
+        if(++history.hour_minutes == HISTORY_MINUTES_PER_HOUR){
+            history.hour_minutes = 0;
+            history_close(history.hour, history.hour_pending);
+            history.eeprom_step = 0;
+        }
+    }
+    history_write_eeprom();
+}
+
+/* Number of entries in all tiers, newest raw sample is entry 0 and the oldest hour the last */
+int history_entry_count(){
+    return history.raw_count + history.minute_count + history.hour_count;
+}
+
+/*
+Read an entry of the history, packed
+@param int entry 0 to history_entry_count() - 1
+@param HistoryRollup& rollup raw samples have the same low, high and average
+@param char& unit 'S', 'M' or 'H'
+@return int age of the entry in units
+*/
+int history_entry(int entry, HistoryRollup& rollup, char& unit){
+    if(entry < history.raw_count){
+        const uint8_t* sample = history.raw[(history.raw_head + HISTORY_RAW_COUNT - 1 - entry) % HISTORY_RAW_COUNT];
+        memcpy(rollup.low, sample, HISTORY_SENSOR_COUNT);
+        memcpy(rollup.high, sample, HISTORY_SENSOR_COUNT);
+        memcpy(rollup.average, sample, HISTORY_SENSOR_COUNT);
+        unit = 'S';
+        return (entry + 1) * (HISTORY_SAMPLE_TIME / 1000);
+    }
+    entry -= history.raw_count;
+    if(entry < history.minute_count){
+        rollup = history.minutes[(history.minute_head + HISTORY_MINUTE_COUNT - 1 - entry) % HISTORY_MINUTE_COUNT];
+        unit = 'M';
+        return entry + 1;
+    }
+    entry -= history.minute_count;
+    int slot = (history.hour_head + HISTORY_HOUR_COUNT - 1 - entry) % HISTORY_HOUR_COUNT;
+    for (unsigned int i = 0; i < sizeof(HistoryRollup); ++i)
+    {
+        ((uint8_t*)&rollup)[i] = EEPROM.read(HISTORY_EEPROM_HOURS + slot * sizeof(HistoryRollup) + i);
+    }
+    unit = 'H';
+    return entry + 1;
+}
+
+/*
+Print one sensor of a history entry as MIN/MAX/AVG, '-' when the sensor had no value
+@param Print& out lcd frame or Serial
+*/
+void print_history_value(Print& out, const HistoryRollup& rollup, int sensor){
+    if(rollup.average[sensor] == HISTORY_NO_VALUE){
+        out.print('-');
+        return;
+    }
+    out.print(history_unpack(sensor, rollup.low[sensor]));
+    out.print('/');
+    out.print(history_unpack(sensor, rollup.high[sensor]));
+    out.print('/');
+    out.print(history_unpack(sensor, rollup.average[sensor]));
+}
+
+/*========== Menu =============*/
+
+/* Setpoint the user can edit from the menu, the table below is kept in flash */
+struct Setpoint {
+    const char* label; // text in flash printed before the value
+    const char* name; // short name in flash for serial commands
+    int* value;
+    int min_value; // value limit
+    int max_value;
+    int step; // change on each up/down press
+    int* not_above; // paired max setpoint this value may not exceed, 0 when not paired
+    int* not_below; // paired min setpoint this value may not go under, 0 when not paired
+    bool per_zone; // value is the first of ZONE_COUNT, selected_zone picks one
+};
+
+const char MIN_TEMP_LABEL[] PROGMEM = "Min temp:";
+const char MAX_TEMP_LABEL[] PROGMEM = "Max temp:";
+const char PERCENT_LABEL[] PROGMEM = "Percent:";
+const char LIGHT_LABEL[] PROGMEM = "Light %:";
+const char BAND_LABEL[] PROGMEM = "Band %:";
+const char GAP_LABEL[] PROGMEM = "Gap cm:";
+const char TOLERANCE_LABEL[] PROGMEM = "Tol cm:";
+const char MIN_TEMP_NAME[] PROGMEM = "tmin";
+const char MAX_TEMP_NAME[] PROGMEM = "tmax";
+const char LIGHT_NAME[] PROGMEM = "light";
+const char BAND_NAME[] PROGMEM = "band";
+const char GAP_NAME[] PROGMEM = "gap";
+const char TOLERANCE_NAME[] PROGMEM = "tol";
+const char SOIL_NAME[] PROGMEM = "soil";
+
+const Setpoint SETPOINTS[] PROGMEM = {
+    {MIN_TEMP_LABEL, MIN_TEMP_NAME, &min_temperature, 0, 140, 5, &max_temperature, 0, false},
+    {MAX_TEMP_LABEL, MAX_TEMP_NAME, &max_temperature, 0, 140, 5, 0, &min_temperature, false},
+    {LIGHT_LABEL, LIGHT_NAME, &max_light_intensity, 0, 100, 5, 0, 0, false},
+    {BAND_LABEL, BAND_NAME, &light_band, 1, 30, 1, 0, 0, false},
+    {GAP_LABEL, GAP_NAME, &distance_gap, 0, 100, 5, 0, 0, false},
+    {TOLERANCE_LABEL, TOLERANCE_NAME, &gap_tolerance, LIFT_DEADBAND + 1, 50, 1, 0, 0, false},
+    {PERCENT_LABEL, SOIL_NAME, min_soil_moinstrure, 0, 100, 5, 0, 0, true},
+};
+const int SETPOINT_COUNT = sizeof(SETPOINTS) / sizeof(SETPOINTS[0]);
+
+/* Copy a setpoint descriptor from flash, a per zone value points to the selected zone */
+Setpoint load_setpoint(int index){
+    Setpoint setpoint;
+    memcpy_P(&setpoint, &SETPOINTS[index], sizeof(Setpoint));
+    if(setpoint.per_zone){
+        setpoint.value += selected_zone;
+    }
+    return setpoint;
+}
+
+/*
+Store a new value in a setpoint, limited to its range and its paired setpoint
+@param const Setpoint& setpoint
+@param int value
+*/
+void set_setpoint(const Setpoint& setpoint, int value){
+    if(value > setpoint.max_value){ // value limit
+        value = setpoint.max_value;
+    }
+    if(value < setpoint.min_value){
+        value = setpoint.min_value;
+    }
+    if(setpoint.not_above != 0 && value > *setpoint.not_above){
+        value = *setpoint.not_above;
+    }
+    if(setpoint.not_below != 0 && value < *setpoint.not_below){
+        value = *setpoint.not_below;
+    }
+    *setpoint.value = value;
+}
+
+/* One option of the menu, the table below is kept in flash */
+struct MenuPage {
+    void (*show)(const MenuPage& page); // called on every ui tick while the option is shown
+    const char* title; // row 1 text in flash, 0 when both rows are setpoints
+    int first_setpoint; // index in SETPOINTS
+    int setpoint_count;
+};
+
+/*
+Home option, print current sensor's values.
+Toggle btn moves on to the history of each sensor, up/down step back and forth in time.
+*/
+void show_home(const MenuPage&){
+    if(toggle_btn_state){
+        home_view = (home_view + 1) % (HISTORY_SENSOR_COUNT + 1);
+        screen.clear();
+    }
+    if(home_view == 0){
+        print_sensors_values(); // only changed digits reach the lcd
+        return;
+    }
+    int sensor = home_view - 1;
+    int count = history_entry_count();
+    if(up_btn_state && history_shown < count - 1){
+        ++history_shown;
+    }
+    if(down_btn_state && history_shown > 0){
+        --history_shown;
+    }
+    screen.setCursor(0,0);
+    screen.print(F("HIST "));
+    screen.print(load_packing(sensor).label);
+    screen.print(' ');
+    screen.setCursor(0,1);
+    if(count == 0){
+        screen.print(F("NO DATA YET     "));
+        return;
+    }
+    history_shown = min(history_shown, count - 1);
+    HistoryRollup rollup;
+    char unit;
+    int age = history_entry(history_shown, rollup, unit);
+    print_history_value(screen, rollup, sensor);
+    screen.print(F("        "));
+    screen.setCursor(8,0);
+    screen.print('-');
+    screen.print(age);
+    screen.print(unit);
+    screen.print(F("    "));
+}
+
+/* Background option, show messages from watering and lamp arm */
+void show_background(const MenuPage&){
+    background_process = true;
+    if(page_redraw){
+        print_message(F("BACKGROUANDS"),F("OPERATIONS "),0,true);
+    }
+}
+
+/*
+Edit the setpoints of an option, one step per up/down press.
+With one setpoint the title is in row 1 and the value in row 2 with a cursor,
+with two setpoints each has a row and toggle btn moves the '<' marker between them.
+*/
+void edit_setpoints(const MenuPage& page){
+    int first_row = (page.setpoint_count == 1)? 1 : 0;
+    // Switch between setpoints based on btn state
+    if(toggle_btn_state && page.setpoint_count > 1){
+        selected_setpoint = (selected_setpoint + 1) % page.setpoint_count;
+        page_redraw = true;
+    }
+    if(selected_setpoint >= page.setpoint_count){
+        selected_setpoint = 0;
+    }
+
+    Setpoint selected = load_setpoint(page.first_setpoint + selected_setpoint);
+    if(up_btn_state){
+        set_setpoint(selected, *selected.value + selected.step);
+    }
+    if(down_btn_state){
+        set_setpoint(selected, *selected.value - selected.step);
+    }
+
+    if(page_redraw && page.title != 0){
+        screen.setCursor(0,0);
+        screen.print((const __FlashStringHelper*)page.title);
+    }
+    // print stored values, the lcd frame only sends digits that changed
+    for (int i = 0; i < page.setpoint_count; ++i)
+    {
+        Setpoint setpoint = load_setpoint(page.first_setpoint + i);
+        int row = first_row + i;
+        int column = strlen_P(setpoint.label);
+        if(page_redraw){
+            screen.setCursor(0,row);
+            screen.print((const __FlashStringHelper*)setpoint.label);
+        }
+        if(page.setpoint_count > 1){
+            screen.setCursor(12,row);
+            screen.write(i == selected_setpoint? '<' : ' ');
+        }
+        print_message(*setpoint.value, column, row, 3);
+    }
+    if(page.setpoint_count == 1){
+        screen.cursor(); // stays after the value
+    }
+}
+
+/* Soil option, toggle btn picks the zone whose setpoint is edited, its number ends row 1 */
+void edit_zone_setpoints(const MenuPage& page){
+    if(toggle_btn_state && ZONE_COUNT > 1){
+        selected_zone = (selected_zone + 1) % ZONE_COUNT;
+    }
+    if(ZONE_COUNT > 1){
+        screen.setCursor(LCD_COLUMNS - 1, 0);
+        screen.print(selected_zone + 1);
+    }
+    edit_setpoints(page);
+}
+
+const char SOIL_TITLE[] PROGMEM = "SOIL MOISTURE %";
+
+// Menu options in the order menu btn moves through them, indexed by *_OPTION
+const MenuPage MENU_PAGES[] PROGMEM = {
+    {show_home, 0, 0, 0},
+    {edit_setpoints, 0, 0, 2},
+    {edit_setpoints, 0, 2, 2},
+    {edit_setpoints, 0, 4, 2},
+    {edit_zone_setpoints, SOIL_TITLE, 6, 1},
+    {show_background, 0, 0, 0},
+};
+const int MENU_PAGE_COUNT = sizeof(MENU_PAGES) / sizeof(MENU_PAGES[0]);
+static_assert(MENU_PAGE_COUNT == BACKGROUND_OPTION + 1, "one menu page per option");
+
+/*Print menu options*/
+void menu(){
+    // on menu click move to next menu option
+    if(menu_btn_state){
+        ++menu_option;
+        if(menu_option >= MENU_PAGE_COUNT){
+            menu_option = HOME_OPTION; // rest menu options
+        }
+    }
+    // clear lcd when moving to another menu option
+    if(menu_option != prev_option){
+        screen.noCursor();
+        screen.clear();
+        prev_option = menu_option;
+        selected_setpoint = 0;
+        home_view = 0;
+        history_shown = 0;
+        message_shown = false;
+        page_redraw = true;
+    }
+    // keep a timed message on screen until it is over, then draw the option again
+    if(message_shown){
+        if(millis() - message_time < message_hold_time){
+            return;
+        }
+        message_shown = false;
+        screen.clear();
+        page_redraw = true;
+    }
+    background_process = false;
+    MenuPage page;
+    memcpy_P(&page, &MENU_PAGES[menu_option], sizeof(MenuPage));
+    page.show(page);
+    page_redraw = false;
+}
+
+/*========== Idle =============*/
+// Between task runs the CPU sleeps in SLEEP_MODE_IDLE. Timers, ADC, UART and pin change
+// interrupts keep running, so millis() ticks and wakes the CPU every ms, pumps and the lamp
+// arm keep their levels and PWM, and a button edge or serial byte wakes it at once.
+// Deeper modes would stop the timers behind PWM and millis(), so actuators could not be left on.
+// A scan of the analog sensors wakes it for each of its conversions, ADC_SCAN_CONVERSIONS in ~5ms every
+// ADC_SCAN_TIME, so the ADC is off most of the time instead of waking the CPU every 104us.
+// The lcd backlight goes off after BACKLIGHT_TIMEOUT without a button press.
+
+const unsigned long BACKLIGHT_TIMEOUT = 30000;
+// Typical supply current, ATmega328P datasheet at 16 MHz and 5 V, and a 16x2 lcd backlight
+const long ACTIVE_CURRENT_UA = 9000;
+const long IDLE_CURRENT_UA = 2500;
+const long BACKLIGHT_CURRENT_UA = 20000;
+// Estimated time awake for an ADC interrupt, its handler and a loop() pass without a task due (~800 cycles)
+const unsigned long ADC_WAKE_US = 50;
+bool backlight_on = true;
+unsigned long last_activity = 0; // millis() of the last button press
+unsigned long idle_since = 0; // millis() when the counters below started
+unsigned long idle_sleeps = 0; // times the CPU went to sleep
+unsigned long idle_sleep_ms = 0; // time asleep
+unsigned int idle_sleep_us = 0; // below a ms, not yet in idle_sleep_ms
+unsigned long backlight_on_ms = 0;
+unsigned long backlight_check_time = 0;
+
+/* Pick the sleep mode and turn off what the sketch does not use */
+void idle_start(){
+#if defined(__AVR__)
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    power_spi_disable(); // shift registers are driven with shiftOut()
+    ACSR |= _BV(ACD); // analog comparator
+#endif
+}
+
+/* Start duty cycle and backlight counters again */
+void idle_reset(){
+    idle_since = millis();
+    idle_sleeps = 0;
+    idle_sleep_ms = 0;
+    idle_sleep_us = 0;
+    adc_scans = 0;
+    backlight_on_ms = 0;
+}
+
+/*
+Sleep until the next interrupt, at most until the next millis() tick.
+@param bool worked a task ran before, the host has no sleep and counts a loop() pass
+without work as a ms asleep and one with work as a ms awake, awake_permille() adds the interrupts
+*/
+void idle_sleep(bool worked){
+    ++idle_sleeps;
+#if defined(__AVR__)
+    (void)worked;
+    unsigned long start = micros();
+    sleep_mode();
+    idle_sleep_us += micros() - start;
+#else
+    if(!worked){
+        idle_sleep_us += 1000;
+    }
+#endif
+    if(idle_sleep_us >= 1000){
+        idle_sleep_ms += idle_sleep_us / 1000;
+        idle_sleep_us %= 1000;
+    }
+}
+
+/*
+Note a button press and light the display when it was dark
+@return bool true when the press only woke the display and should not do anything else
+*/
+bool wake_display(){
+    last_activity = millis();
+    if(backlight_on){
+        return false;
+    }
+    backlight_on = true;
+    backlight_check_time = last_activity;
+    lcd.setBacklight(HIGH);
+    return true;
+}
+
+/* Turn the backlight off after BACKLIGHT_TIMEOUT without a press and count its on time */
+void check_backlight(){
+    unsigned long now = millis();
+    if(!backlight_on){
+        return;
+    }
+    backlight_on_ms += now - backlight_check_time;
+    backlight_check_time = now;
+    if(now - last_activity >= BACKLIGHT_TIMEOUT){
+        backlight_on = false;
+        lcd.setBacklight(LOW);
+    }
+}
+
+/* Time the CPU was awake since idle_reset(), in 1/1000 */
+long awake_permille(){
+    unsigned long elapsed = millis() - idle_since;
+    if(elapsed == 0){
+        return 1000;
+    }
+    unsigned long long asleep_us = (unsigned long long)idle_sleep_ms * 1000;
+#if !defined(__AVR__)
+    // the host has no ADC interrupts, on the board each conversion of a scan cuts a sleep short
+    unsigned long long woken_us = (unsigned long long)adc_scans * ADC_SCAN_CONVERSIONS * ADC_WAKE_US;
+    asleep_us = asleep_us > woken_us ? asleep_us - woken_us : 0;
+#endif
+    return 1000 - (long)(asleep_us / elapsed);
+}
+
+/* Time the backlight was on since idle_reset(), in 1/1000 */
+long backlight_permille(){
+    unsigned long elapsed = millis() - idle_since;
+    return elapsed == 0 ? 1000 : (long)((unsigned long long)backlight_on_ms * 1000 / elapsed);
+}
+
+/* Mean supply current of the MCU and backlight since idle_reset() */
+long estimated_current_ua(){
+    long awake = awake_permille();
+    return (ACTIVE_CURRENT_UA * awake + IDLE_CURRENT_UA * (1000 - awake)
+            + BACKLIGHT_CURRENT_UA * backlight_permille()) / 1000;
+}
+
+void setup() {
+#if INSTRUMENTATION
+    memory_paint();
+#endif
+    // set up the LCD's number of columns and rows:
+    lcd.begin(16, 2);
+
+    // Set RGB pins mode, with shift registers zones_start() sets up their pins
+    if(!Board::SHIFT_REGISTERS){
+        pinMode(RED_RGB_PIN, OUTPUT);
+        pinMode(BLUE_RGB_PIN, OUTPUT);
+        pinMode(GREEN_RGB_PIN, OUTPUT);
+        pinMode(DC_PUMP_PIN,OUTPUT);
+    }
+
+    // Set buzzer pin mode
+    pinMode(BUZZER, OUTPUT);
+
+    // Set light sensor pin mode
+    pinMode(LIGHT_SENSOR_PIN,INPUT);
+    pinMode(LAMP_PIN,OUTPUT);
 
     // Set DC motor pins mode
     pinMode(DC_INPUT1_PIN,OUTPUT);
     pinMode(DC_INPUT2_PIN,OUTPUT);
     pinMode(DC_PWM,OUTPUT);
-    pinMode(DC_PUMP_PIN,OUTPUT);
     
     // Set buttons pin mode
-    pinMode(MENU_BTN_PIN,INPUT);
+    if(!SERIAL_LINK){
+        pinMode(MENU_BTN_PIN,INPUT);
+    }
     pinMode(BTN_TOGGLE_PIN,INPUT);
     pinMode(UP_BTN_PIN,INPUT);
     pinMode(DOWN_BTN_PIN,INPUT);
+    start_buttons();
+
+    // Default setpoints of the zones, shift registers when there are several
+    zones_start();
+
+    // Start reading analog sensors in background
+    adc_start();
+
+    // Sleep between task runs
+    idle_start();
+
+    history_start();
+
+    // Fault log and watchdog, last so a slow setup does not reset the board
+    safety_start();
+
+#if SERIAL_LINK
+    Serial.begin(SERIAL_BAUD);
+#endif
+}
+
+/*========== Tasks =============*/
+
+/* Read and assign current sensor's values */
+void sense_task(){
+    if(!adc_ready()){
+        return; // no value yet right after start
+    }
+    current_temperature = read_temperature(TEMPERATURE_PIN);
+    current_light_intensity = read_light_intensity();
+    temperature_sensor_ok = adc_ok(TEMPERATURE_PIN);
+    for (int zone = 0; zone < ZONE_COUNT; ++zone)
+    {
+        current_soil_moisture[zone] = read_soil_moisture(zone);
+        current_soil_moisture_tenths[zone] = read_soil_moisture_tenths(zone);
+        soil_sensor_ok[zone] = adc_ok(SOIL_MOISTURE_PIN, zone);
+    }
+}
+
+/* Move the samples of the last scan to the filters and start the next */
+void adc_task(){
+    adc_drain();
+    adc_scan();
+}
+
+/* Pick up ultrasonic echo and send next ping */
+void distance_task(){
+    read_distance();
+}
+
+#if PULSE_WATERING
+/* Start watering every 2s and close pumps when pulse is over */
+void water_task(){
+    unsigned long current_milliseconds = millis();
+    for (int zone = 0; zone < ZONE_COUNT; ++zone)
+    {
+        stop_pump(zone, PUMP_PULSE_TIME);
+    }
+    if(current_milliseconds - prev_milliseconds > TIME_2_SECONDS){
+        for (int zone = 0; zone < ZONE_COUNT; ++zone)
+        {
+            if(!pump_running[zone]){
+                water_plants(zone);
+            }
+        }
+        prev_milliseconds = current_milliseconds;
+    }
+}
+#else
+/* Dose water and watch it soak in, zones take turns at being first to get a free pump */
+void water_task(){
+    for (int i = 0; i < ZONE_COUNT; ++i)
+    {
+        water_plants((water_first_zone + i) % ZONE_COUNT);
+    }
+    water_first_zone = (water_first_zone + 1) % ZONE_COUNT;
+}
+#endif
+
+/* Sense the soil of the next zone */
+void zone_task(){
+#if ZONE_COUNT > 1
+    select_zone_sensor((adc_zone + 1) % ZONE_COUNT);
+#endif
+}
+
+/* Keep sensor values over time */
+void history_task(){
+    if(!adc_ready()){
+        return; // no value yet right after start
+    }
+    history_sample();
+}
+
+/* keep fixed gap within gap_tolerance */
+void gap_task(){
+    keep_gap(gap_tolerance);
+}
+
+/* turn on/off lamp */
+void light_task(){
+    check_light();
+}
+
+/* set alert if there are any errors */
+void alert_task(){
+    alert();
+}
+
+/* Send changed screen cells to lcd */
+void display_task(){
+    screen.refresh(LCD_CELLS_PER_TICK);
+}
+
+/* Debounce buttons and queue their events */
+void button_task(){
+    scan_buttons();
+}
+
+/* Handle queued button events, print menu options and turn on/off buzzer */
+void ui_task(){
+    // one event at a time, last pass without event redraws the menu option
+    int event;
+    do{
+        event = next_button_event();
+        if(event != BTN_NONE && (event & 0x0F) == BTN_PRESS && wake_display()){
+            continue; // first press only lights the display
+        }
+        menu_btn_state = event == button_event(MENU_BUTTON, BTN_PRESS);
+        // a short toggle press is for the page and acts on release, a long one only mutes the buzzer
+        if(event == button_event(TOGGLE_BUTTON, BTN_PRESS)){
+            toggle_pending = true;
+        }
+        toggle_long_press = event == button_event(TOGGLE_BUTTON, BTN_LONG_PRESS);
+        toggle_btn_state = toggle_pending && event == button_event(TOGGLE_BUTTON, BTN_RELEASE);
+        if(toggle_long_press || toggle_btn_state){
+            toggle_pending = false;
+        }
+        up_btn_state = event == button_event(UP_BUTTON, BTN_PRESS) || event == button_event(UP_BUTTON, BTN_REPEAT);
+        down_btn_state = event == button_event(DOWN_BUTTON, BTN_PRESS) || event == button_event(DOWN_BUTTON, BTN_REPEAT);
+        // Print menu options
+        menu();
+        //turn on/off buzzer
+        reset_buzzer();
+    }while(event != BTN_NONE);
+    check_backlight();
+}
+
+/*
+Cooperative task, run by loop() every period milliseconds.
+A task must return quickly, anything that takes time is split over several runs.
+*/
+struct Task {
+    const char* name; // in flash
+    void (*run)();
+    unsigned long period; // ms between two runs
+    unsigned long deadline; // ms a run may start late before it counts as missed
+    unsigned long last_run;
+    unsigned int missed; // number of runs started later than deadline
+};
+
+void safety_task();
+void stats_task();
+void command_task();
+void telemetry_task();
+void record_task();
+
+const char ADC_TASK_NAME[] PROGMEM = "adc";
+const char SENSE_TASK_NAME[] PROGMEM = "sense";
+const char ZONE_TASK_NAME[] PROGMEM = "zone";
+const char DISTANCE_TASK_NAME[] PROGMEM = "distance";
+const char WATER_TASK_NAME[] PROGMEM = "water";
+const char GAP_TASK_NAME[] PROGMEM = "gap";
+const char HISTORY_TASK_NAME[] PROGMEM = "history";
+const char LIGHT_TASK_NAME[] PROGMEM = "light";
+const char ALERT_TASK_NAME[] PROGMEM = "alert";
+const char SAFETY_TASK_NAME[] PROGMEM = "safety";
+const char BUTTON_TASK_NAME[] PROGMEM = "button";
+const char UI_TASK_NAME[] PROGMEM = "ui";
+const char DISPLAY_TASK_NAME[] PROGMEM = "display";
+const char STATS_TASK_NAME[] PROGMEM = "stats";
+const char COMMAND_TASK_NAME[] PROGMEM = "command";
+const char TELEMETRY_TASK_NAME[] PROGMEM = "telemetry";
+const char RECORD_TASK_NAME[] PROGMEM = "record";
+
+// Tasks in the order they run when due at the same time, sensors are read first
+Task tasks[] = {
+    {ADC_TASK_NAME, adc_task, ADC_SCAN_TIME, 10, 0, 0},
+    {SENSE_TASK_NAME, sense_task, 100, 20, 0, 0},
+    {ZONE_TASK_NAME, zone_task, ZONE_DWELL_TIME, 20, 0, 0},
+    {DISTANCE_TASK_NAME, distance_task, 5, 5, 0, 0},
+    {WATER_TASK_NAME, water_task, 50, 50, 0, 0},
+    {GAP_TASK_NAME, gap_task, 50, 10, 0, 0},
+    {HISTORY_TASK_NAME, history_task, HISTORY_SAMPLE_TIME, 1000, 0, 0},
+    {LIGHT_TASK_NAME, light_task, 250, 100, 0, 0},
+    {ALERT_TASK_NAME, alert_task, ALERT_TICK, 100, 0, 0},
+    {SAFETY_TASK_NAME, safety_task, 100, 50, 0, 0},
+    {BUTTON_TASK_NAME, button_task, 5, 5, 0, 0},
+    {RECORD_TASK_NAME, record_task, 5, 5, 0, 0}, // after the inputs changed, before the ui takes button events
+    {UI_TASK_NAME, ui_task, 50, 50, 0, 0},
+    {DISPLAY_TASK_NAME, display_task, 10, 10, 0, 0},
+    {STATS_TASK_NAME, stats_task, 20, 100, 0, 0},
+    {COMMAND_TASK_NAME, command_task, 20, 20, 0, 0},
+    {TELEMETRY_TASK_NAME, telemetry_task, 20, 20, 0, 0},
+};
+const int TASK_COUNT = sizeof(tasks) / sizeof(tasks[0]);
+
+/*========== Safety =============*/
+// Supervision that does not rely on the tasks it watches.
+// Watchdog: the hardware watchdog runs in interrupt and reset mode with a SAFETY_WATCHDOG_TIME
+// timeout, loop() feeds it after every pass while all tasks keep running. One task is checked in
+// a pass, one that has not run for twice its period and SAFETY_CHECKIN_SLACK stops the feeding for
+// good. A pass that hangs or a task that stopped lets the watchdog interrupt switch off the pumps
+// and the lift motor and note the task that was running, the next timeout resets the board and
+// setup() logs the hang, it knows it from MCUSR.
+// Actuators: set_pump() and drive_lift() switch on only while safety_allow() lets them. A pump or
+// the lift motor on longer than its max_on at once, or for more than its budget within
+// SAFETY_WINDOW, is switched off and held off for its cooldown whatever the control logic asks.
+// Faults go to a ring at the end of EEPROM, about 15 ms of writes each, see safety_fault().
+// Without a fault a pass only pays a check-in and safety_task() a few compares per actuator.
+
+const unsigned long SAFETY_WATCHDOG_TIME = 1000; // ms, WDTO_1S
+const unsigned long SAFETY_CHECKIN_SLACK = 500; // ms a task may start late before it counts as stopped
+const unsigned long SAFETY_WINDOW = 3600000; // ms over which the on time budgets count
+const uint8_t SAFETY_NO_TASK = 0xFF;
+
+// Fault codes in the log
+const uint8_t SAFETY_HANG = 1; // the watchdog interrupt came, detail is the task that was running
+const uint8_t SAFETY_LATE = 2; // a task stopped running, detail is the task
+const uint8_t SAFETY_MAX_ON = 3; // an actuator was on too long at once, detail is the actuator
+const uint8_t SAFETY_BUDGET = 4; // an actuator used up its budget, detail is the actuator
+
+/* Limits of an actuator */
+struct SafetyLimits {
+    unsigned long max_on; // ms on at once
+    unsigned long budget; // ms on within SAFETY_WINDOW
+    unsigned long cooldown; // ms held off after a trip
+};
+
+const SafetyLimits SAFETY_LIMITS[] PROGMEM = {
+    {3 * WATER_MAX_DOSE, 60000, 3600000}, // a pump, a pot takes a few doses of at most WATER_MAX_DOSE a day
+    {LIFT_TIMEOUT + 5000, 120000, 3600000}, // lift motor, keep_gap() gives up a correction after LIFT_TIMEOUT
+};
+
+/* What the supervisor knows of an actuator */
+struct ActuatorGuard {
+    unsigned long on_time; // millis() when it went on
+    unsigned long count_time; // millis() up to which used counts
+    unsigned long used; // ms on in the current window
+    unsigned long held_time; // millis() when it was held off
+    bool on;
+    bool held;
+};
+
+/* An entry of the fault log */
+struct SafetyFault {
+    uint8_t code; // SAFETY_*, 0 for an empty entry
+    uint8_t detail; // task or actuator index
+    uint16_t minute; // since the board started
+};
+
+const int SAFETY_LOG_COUNT = 8;
+const uint8_t SAFETY_LOG_MAGIC = 0x5A; // changes with the layout, an older log is emptied
+const int SAFETY_LOG_SIZE = 2 + SAFETY_LOG_COUNT * sizeof(SafetyFault); // magic, next entry, entries
+const int SAFETY_LOG_START = EEPROM_SIZE - SAFETY_LOG_SIZE;
+static_assert(HISTORY_EEPROM_HOURS + HISTORY_HOUR_COUNT * sizeof(HistoryRollup) <= SAFETY_LOG_START,
+              "fault log overlaps the history in EEPROM");
+static_assert(TASK_COUNT < SAFETY_NO_TASK, "task index does not fit a fault");
+
+const char SAFETY_HANG_NAME[] PROGMEM = "hang";
+const char SAFETY_LATE_NAME[] PROGMEM = "late";
+const char SAFETY_MAX_ON_NAME[] PROGMEM = "max_on";
+const char SAFETY_BUDGET_NAME[] PROGMEM = "budget";
+const char* const SAFETY_FAULT_NAMES[] PROGMEM = {
+    SAFETY_HANG_NAME, SAFETY_LATE_NAME, SAFETY_MAX_ON_NAME, SAFETY_BUDGET_NAME,
+};
+const int SAFETY_FAULT_CODES = sizeof(SAFETY_FAULT_NAMES) / sizeof(SAFETY_FAULT_NAMES[0]);
+
+ActuatorGuard safety_guards[SAFETY_ACTUATORS];
+unsigned long safety_window_time = 0; // millis() when the current window started
+int safety_check_task = 0; // task checked in the next pass
+bool safety_starved = false; // a task stopped, the watchdog is no longer fed
+volatile uint8_t safety_running_task = SAFETY_NO_TASK; // task run_tasks() is in
+unsigned long safety_faults = 0; // logged since the start, for instrumentation
+const uint8_t SAFETY_RESET_MAGIC = 0xA5; // safety_reset_task holds the task of a hang
+const uint8_t SAFETY_WATCHDOG_RESET = 1 << 3; // WDRF of MCUSR
+#if defined(__AVR__)
+// Left alone by the startup code, so the watchdog interrupt can hand them over the reset
+uint8_t safety_reset_magic __attribute__((section(".noinit")));
+uint8_t safety_reset_task __attribute__((section(".noinit")));
+uint8_t safety_reset_flags __attribute__((section(".noinit"))); // MCUSR at the start
+
+/* Runs before main(): keep why the board reset and stop a watchdog that survived it */
+void safety_early() __attribute__((naked, used, section(".init3")));
+void safety_early(){
+    __asm__ __volatile__("sts %0, r2" : "=m"(safety_reset_flags)); // optiboot clears MCUSR and passes it in r2
+    safety_reset_flags |= MCUSR;
+    MCUSR = 0;
+    wdt_disable();
+}
+#else
+uint8_t safety_reset_magic = 0;
+uint8_t safety_reset_task = SAFETY_NO_TASK;
+uint8_t safety_reset_flags = 0; // the simulation sets it for a watchdog reset
+unsigned long safety_fed_time = 0; // millis() of the last feed, the simulation plays the watchdog
+#endif
+
+/*
+Add a fault to the log, the newest entry replaces the oldest
+@param uint8_t code SAFETY_*
+@param uint8_t detail task or actuator index
+*/
+void safety_log(uint8_t code, uint8_t detail){
+    SafetyFault fault = {code, detail, (uint16_t)min(millis() / 60000, 0xFFFFUL)};
+    int next = EEPROM.read(SAFETY_LOG_START + 1) % SAFETY_LOG_COUNT;
+    for (unsigned int i = 0; i < sizeof(SafetyFault); ++i)
+    {
+        EEPROM.update(SAFETY_LOG_START + 2 + next * sizeof(SafetyFault) + i, ((const uint8_t*)&fault)[i]);
+    }
+    EEPROM.update(SAFETY_LOG_START + 1, (next + 1) % SAFETY_LOG_COUNT);
+    ++safety_faults;
+}
+
+/*
+Read an entry of the fault log, it outlives a reset
+@param int entry 0 for the newest
+@param SafetyFault& fault
+@return bool false when there is no such entry
+*/
+bool safety_fault(int entry, SafetyFault& fault){
+    if(entry >= SAFETY_LOG_COUNT){
+        return false;
+    }
+    int slot = (EEPROM.read(SAFETY_LOG_START + 1) + SAFETY_LOG_COUNT - 1 - entry) % SAFETY_LOG_COUNT;
+    for (unsigned int i = 0; i < sizeof(SafetyFault); ++i)
+    {
+        ((uint8_t*)&fault)[i] = EEPROM.read(SAFETY_LOG_START + 2 + slot * sizeof(SafetyFault) + i);
+    }
+    return fault.code != 0;
+}
+
+/*
+Print MINUTE FAULT WHAT of a log entry, WHAT is a task name, pumpN or lift
+@param Print& out
+@param const SafetyFault& fault
+*/
+void safety_print_fault(Print& out, const SafetyFault& fault){
+    const char* name;
+    memcpy_P(&name, &SAFETY_FAULT_NAMES[(fault.code - 1) % SAFETY_FAULT_CODES], sizeof(name));
+    out.print(fault.minute);
+    out.print(' ');
+    out.print((const __FlashStringHelper*)name);
+    out.print(' ');
+    if(fault.code == SAFETY_HANG || fault.code == SAFETY_LATE){
+        if(fault.detail < TASK_COUNT){
+            out.print((const __FlashStringHelper*)tasks[fault.detail].name);
+        }else{
+            out.print('-');
+        }
+    }else if(fault.detail == SAFETY_LIFT){
+        out.print(F("lift"));
+    }else{
+        out.print(F("pump"));
+        out.print(fault.detail + 1);
+    }
+}
+
+/* Empty the fault log when EEPROM holds none, log the hang behind a watchdog reset and turn the watchdog on */
+void safety_start(){
+    if(EEPROM.read(SAFETY_LOG_START) != SAFETY_LOG_MAGIC){
+        for (int i = 1; i < SAFETY_LOG_SIZE; ++i)
+        {
+            EEPROM.update(SAFETY_LOG_START + i, 0);
+        }
+        EEPROM.update(SAFETY_LOG_START, SAFETY_LOG_MAGIC);
+    }
+    if((safety_reset_flags & SAFETY_WATCHDOG_RESET) && safety_reset_magic == SAFETY_RESET_MAGIC){
+        safety_log(SAFETY_HANG, safety_reset_task);
+    }
+    safety_reset_magic = 0;
+#if defined(__AVR__)
+    wdt_enable(WDTO_1S);
+    WDTCSR |= _BV(WDIE); // interrupt at the first timeout, reset at the next
+#else
+    safety_fed_time = millis();
+#endif
+}
+
+/*
+Let an actuator switch on unless it is held, and count its on time
+@param int actuator zone of a pump or SAFETY_LIFT
+@param bool on what the control logic asks for
+@return bool true when it is on now
+*/
+bool safety_allow(int actuator, bool on){
+    ActuatorGuard& guard = safety_guards[actuator];
+    on = on && !guard.held;
+    if(on != guard.on){
+        unsigned long now = millis();
+        if(on){
+            guard.on_time = now;
+            guard.count_time = now;
+        }else{
+            guard.used += now - guard.count_time;
+        }
+        guard.on = on;
+    }
+    return on;
+}
+
+/* true while an actuator is held off after a trip or the watchdog interrupt */
+bool safety_held(int actuator){
+    return safety_guards[actuator].held;
+}
+
+/*
+Switch an actuator off through the control outputs
+@param int actuator zone of a pump or SAFETY_LIFT
+*/
+void safety_off(int actuator){
+    if(actuator == SAFETY_LIFT){
+        drive_lift(0);
+    }else{
+        set_pump(actuator, false);
+    }
+}
+
+/*
+Switch an actuator off and hold it off for its cooldown
+@param int actuator zone of a pump or SAFETY_LIFT
+@param uint8_t code SAFETY_* logged as the reason
+*/
+void safety_trip(int actuator, uint8_t code){
+    safety_guards[actuator].held = true;
+    safety_guards[actuator].held_time = millis();
+    safety_off(actuator);
+    safety_log(code, actuator);
 }
 
-void loop() {
+/* Hold off an actuator that was on too long at once or used up its budget, let it go after its cooldown */
+void safety_task(){
+    unsigned long now = millis();
+    bool new_window = now - safety_window_time >= SAFETY_WINDOW;
+    if(new_window){
+        safety_window_time = now;
+    }
+    for (int actuator = 0; actuator < SAFETY_ACTUATORS; ++actuator)
+    {
+        ActuatorGuard& guard = safety_guards[actuator];
+        SafetyLimits limits;
+        memcpy_P(&limits, &SAFETY_LIMITS[actuator == SAFETY_LIFT ? 1 : 0], sizeof(SafetyLimits));
+        if(new_window){
+            guard.used = 0;
+            guard.count_time = now;
+        }
+        if(guard.held && now - guard.held_time >= limits.cooldown){
+            guard.held = false;
+        }
+        if(!guard.on){
+            continue;
+        }
+        if(guard.held){ // held by the watchdog interrupt, which cannot reach the shift register chain
+            safety_off(actuator);
+        }else if(now - guard.on_time > limits.max_on){
+            safety_trip(actuator, SAFETY_MAX_ON);
+        }else if(guard.used + (now - guard.count_time) > limits.budget){
+            safety_trip(actuator, SAFETY_BUDGET);
+        }
+    }
+}
 
-    // Read and assign current sensor's values
-    current_distance = read_distance(ULTRASONIC_PIN,ULTRASONIC_PIN);
-    current_temperature = read_temperature(TEMPERATURE_PIN);
-    current_light_intensity = read_light_intensity();
-    current_soil_moisture = read_soil_moisture();
-    do{
-        // read button's state
-        menu_btn_state = digitalRead(MENU_BTN_PIN);
-        toggle_btn_state = digitalRead(BTN_TOGGLE_PIN);
-        delay(BTN_DELAY_TIME);
-        // Print menu options
-        menu();
-    }while(digitalRead(MENU_BTN_PIN));
-
-    unsigned long current_milliseconds = millis(); // track time
-
-    if(!menu_btn_state){
-        // Start watering every Ns
-        if(current_milliseconds - prev_milliseconds > TIME_2_SECONDS){
-            water_plants();
-            prev_milliseconds = current_milliseconds;
-        }
-        // set alert if there are any errors
-        alert();
-        // keep fixed gap with 10 cm tolerance error 
-        keep_gap(10); 
-    }
-    // turn on/off lamp
-    check_light(); 
-    //turn on/off buzzer
-    reset_buzzer(current_milliseconds);
-    // Reset button's state
-    menu_btn_state = false;
-    toggle_btn_state = false;
+/*
+What the watchdog interrupt does before the reset. It may come in the middle of anything, so it
+only holds every pump and the lift motor off and switches off what it reaches with single port
+writes, the pump of BOARD_POT and the inputs of the motor bridge. The pumps of the shift register
+chain stay as they are until safety_task() or the setup() after the reset closes them. The task
+that hung is left to safety_start() after the reset, EEPROM writes do not belong here.
+*/
+void safety_watchdog(){
+    unsigned long now = millis();
+    for (int actuator = 0; actuator < SAFETY_ACTUATORS; ++actuator)
+    {
+        safety_guards[actuator].held = true;
+        safety_guards[actuator].held_time = now;
+    }
+    FastPin<DC_PUMP_PIN>::write(false);
+    FastPin<DC_INPUT1_PIN>::write(false);
+    FastPin<DC_INPUT2_PIN>::write(false);
+    if(!safety_starved){ // a stopped task was logged when it was found
+        safety_reset_task = safety_running_task;
+        safety_reset_magic = SAFETY_RESET_MAGIC;
+    }
+}
+
+/* Check in one task and feed the watchdog while no task has stopped, loop() calls it after every pass */
+void safety_feed(){
+    const Task& task = tasks[safety_check_task];
+    if(!safety_starved && millis() - task.last_run > 2 * task.period + SAFETY_CHECKIN_SLACK){
+        safety_starved = true;
+        safety_log(SAFETY_LATE, safety_check_task);
+    }
+    safety_check_task = (safety_check_task + 1) % TASK_COUNT;
+    if(safety_reset_magic == SAFETY_RESET_MAGIC){ // a pass came back after the interrupt but before the reset
+        safety_reset_magic = 0;
+        safety_log(SAFETY_HANG, safety_reset_task);
+    }
+    if(safety_starved){
+        return;
+    }
+#if defined(__AVR__)
+    wdt_reset();
+    WDTCSR |= _BV(WDIE); // the interrupt clears it, a pass that came back in time arms it again
+#else
+    safety_fed_time = millis();
+#endif
+}
+
+#if defined(__AVR__)
+ISR(WDT_vect){
+    safety_watchdog();
+}
+#endif
+
+/*========== Instrumentation =============*/
+// Run time of every task and of the whole loop() pass, nothing of it is compiled when INSTRUMENTATION is 0
+
+#if INSTRUMENTATION
+const int LOOP_STAGE = TASK_COUNT; // stats index of loop(), tasks use their own index
+const int STAGE_COUNT = TASK_COUNT + 1;
+const int HISTOGRAM_BUCKETS = 12; // bucket n counts runs of 2^n to 2^(n+1)-1 us, last one also longer runs
+const unsigned long STAGE_BUDGET_US = 5000; // runs longer than this are counted as overrun
+
+/* Timing of one stage */
+struct StageStats {
+    unsigned long count;
+    unsigned long total_us;
+    unsigned int min_us;
+    unsigned int max_us;
+    unsigned int overruns;
+    unsigned int max_late_ms; // tasks only, latest start after period
+    unsigned int histogram[HISTOGRAM_BUCKETS];
+};
+
+StageStats stage_stats[STAGE_COUNT];
+int stats_dump_line = -1; // next line of a running dump, -1 when not dumping
+
+/* Forget all measurements */
+void reset_stats(){
+    memset(stage_stats, 0, sizeof(stage_stats));
+    idle_reset();
+    lamp_switches = 0;
+    lamp_full_ms = 0;
+    alert_raises = 0;
+}
+
+/*
+Add one run to the stats of a stage
+@param int stage task index or LOOP_STAGE
+@param unsigned long us run time
+*/
+void record_stage(int stage, unsigned long us){
+    StageStats &stats = stage_stats[stage];
+    unsigned int clamped = (us > 0xFFFF)? 0xFFFF : us;
+    ++stats.count;
+    stats.total_us += us;
+    if(stats.count == 1 || clamped < stats.min_us){
+        stats.min_us = clamped;
+    }
+    if(clamped > stats.max_us){
+        stats.max_us = clamped;
+    }
+    if(us > STAGE_BUDGET_US){
+        ++stats.overruns;
+    }
+    int bucket = 0;
+    while(us > 1 && bucket < HISTOGRAM_BUCKETS - 1){
+        us >>= 1;
+        ++bucket;
+    }
+    if(stats.histogram[bucket] < 0xFFFF){
+        ++stats.histogram[bucket];
+    }
+}
+
+/* Print name of a stage */
+void print_stage_name(int stage){
+    if(stage == LOOP_STAGE){
+        Serial.print(F("loop"));
+    }else{
+        Serial.print((const __FlashStringHelper*)tasks[stage].name);
+    }
+}
+
+/*
+Print next line of the stats dump, two lines per stage:
+name n=count min= max= avg= over= late= missed= in us and ms
+name h= histogram counts
+a line idle awake= backlight= in percent, sleeps= and current= estimated in uA,
+a line lamp switches= on= in full duty minutes and gain= in percent,
+and a last line alerts raised= since the reset, active= with a bit per active alert and faults= logged
+since the start.
+Only when the whole line fits in the serial buffer, so printing never waits.
+*/
+void print_stats_line(){
+    if(Serial.availableForWrite() < 60){
+        return;
+    }
+    if(stats_dump_line == 2 * STAGE_COUNT){
+        Serial.print(F("idle awake="));
+        Serial.print(awake_permille() / 10);
+        Serial.print(F(" sleeps="));
+        Serial.print(idle_sleeps);
+        Serial.print(F(" backlight="));
+        Serial.print(backlight_permille() / 10);
+        Serial.print(F(" current="));
+        Serial.println(estimated_current_ua());
+        ++stats_dump_line;
+        return;
+    }
+    if(stats_dump_line == 2 * STAGE_COUNT + 1){
+        Serial.print(F("lamp switches="));
+        Serial.print(lamp_switches);
+        Serial.print(F(" on="));
+        Serial.print(lamp_full_ms / 60000);
+        Serial.print(F(" gain="));
+        Serial.println(lamp_gain);
+        ++stats_dump_line;
+        return;
+    }
+    if(stats_dump_line == 2 * STAGE_COUNT + 2){
+        Serial.print(F("alerts raised="));
+        Serial.print(alert_raises);
+        Serial.print(F(" active="));
+        Serial.print((int)alerts_active); // bit per ALERT_*
+        Serial.print(F(" faults="));
+        Serial.println(safety_faults);
+        ++stats_dump_line;
+        return;
+    }
+    if(stats_dump_line == 2 * STAGE_COUNT + 3){
+        Serial.print(F("memory stack_unused="));
+        Serial.print(memory_stack_unused());
+        Serial.print(F(" heap="));
+        Serial.println(memory_heap_used());
+        stats_dump_line = -1;
+        return;
+    }
+    int stage = stats_dump_line / 2;
+    const StageStats &stats = stage_stats[stage];
+    print_stage_name(stage);
+    if(stats_dump_line % 2 == 0){
+        Serial.print(F(" n="));
+        Serial.print(stats.count);
+        Serial.print(F(" min="));
+        Serial.print(stats.count == 0 ? 0 : stats.min_us);
+        Serial.print(F(" max="));
+        Serial.print(stats.max_us);
+        Serial.print(F(" avg="));
+        Serial.print(stats.count == 0 ? 0 : stats.total_us / stats.count);
+        Serial.print(F(" over="));
+        Serial.print(stats.overruns);
+        if(stage != LOOP_STAGE){
+            Serial.print(F(" late="));
+            Serial.print(stats.max_late_ms);
+            Serial.print(F(" missed="));
+            Serial.print(tasks[stage].missed);
+        }
+    }else{
+        Serial.print(F(" h="));
+        for (int i = 0; i < HISTOGRAM_BUCKETS; ++i)
+        {
+            if(i > 0){
+                Serial.print(',');
+            }
+            Serial.print(stats.histogram[i]);
+        }
+    }
+    Serial.println();
+    ++stats_dump_line;
+}
+
+#define STAGE_BEGIN(name) unsigned long name = micros()
+#define STAGE_END(stage, name) record_stage(stage, micros() - name)
+#define STAGE_LATE(stage, ms) if((ms) > stage_stats[stage].max_late_ms) stage_stats[stage].max_late_ms = (ms)
+#else
+#define STAGE_BEGIN(name)
+#define STAGE_END(stage, name)
+#define STAGE_LATE(stage, ms)
+#endif
+
+#if INSTRUMENTATION
+/* Send the stats from the next stats_task() run on, unless a dump is running */
+void start_stats_dump(){
+    if(stats_dump_line < 0){
+        stats_dump_line = 0;
+    }
+}
+#endif
+
+/* Send a stats dump line by line once the stats command started it */
+void stats_task(){
+#if INSTRUMENTATION
+    if(stats_dump_line >= 0){
+        print_stats_line();
+    }
+#endif
+}
+
+/*========== Serial commands =============*/
+// Setpoints are read and written over serial, one command a line ended by '\n':
+//   get NAME          reply NAME=VALUE
+//   set NAME VALUE    value is limited like from the menu, reply NAME=VALUE as stored
+//   dump              NAME=VALUE for every setpoint
+//   begin             following sets are only staged ...
+//   commit            ... and stored together, or none of them when one is out of range, reply OK
+//   abort             drop staged sets
+//   zone N            pick the zone whose soil setpoint get and set use, 1 to ZONE_COUNT, not in a batch
+//   menu              same as a press of the menu button, which can not be read while serial is on
+//   history           every history entry newest first, AGE then MIN/MAX/AVG of TE SM LT DI
+//   faults            fault log newest first, minute since the start, fault and task or actuator
+//   stats, reset      INSTRUMENTATION stats dump and reset
+// Errors reply ERR and the reason. Lines are split in place in a fixed buffer, nothing is copied.
+
+#if SERIAL_COMMANDS
+const int COMMAND_LINE_SIZE = 32; // longer lines are dropped with ERR long
+const int COMMAND_MAX_TOKENS = 3;
+const int COMMAND_REPLY_SIZE = 24; // serial buffer room needed before a line is run, so replies never wait
+char command_line[COMMAND_LINE_SIZE];
+uint8_t command_length = 0;
+bool command_overflow = false; // current line did not fit, rest of it is skipped
+bool command_batch = false; // between begin and commit
+int command_staged[SETPOINT_COUNT]; // values set in the batch
+uint8_t command_staged_mask = 0; // bit per setpoint set in the batch
+int command_dump_index = -1; // next setpoint of a running dump, -1 when not dumping
+const int HISTORY_LINE_SIZE = 56; // serial buffer room needed for a history line
+int command_history_entry = -1; // next entry of a running history dump, -1 when not dumping
+int command_fault_entry = -1; // next entry of a running fault log dump, -1 when not dumping
+
+static_assert(SETPOINT_COUNT <= 8, "staged setpoints do not fit command_staged_mask");
+
+/*
+Find a setpoint by its short name
+@param const char* name
+@return int index in SETPOINTS, -1 when there is none
+*/
+int find_setpoint(const char* name){
+    for (int i = 0; i < SETPOINT_COUNT; ++i)
+    {
+        if(strcmp_P(name, load_setpoint(i).name) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Print AGE and every sensor of a history entry */
+void print_history_line(int entry){
+    HistoryRollup rollup;
+    char unit;
+    Serial.print('-');
+    Serial.print(history_entry(entry, rollup, unit));
+    Serial.print(unit);
+    for (int i = 0; i < HISTORY_SENSOR_COUNT; ++i)
+    {
+        Serial.print(' ');
+        print_history_value(Serial, rollup, i);
+    }
+    Serial.println();
+}
+
+/* Print NAME=VALUE of a setpoint */
+void print_setpoint(int index){
+    Setpoint setpoint = load_setpoint(index);
+    Serial.print((const __FlashStringHelper*)setpoint.name);
+    Serial.print('=');
+    Serial.println(*setpoint.value);
+}
+
+/*
+Parse a decimal number
+@param const char* text
+@param int& value set when text is a number
+@return bool false when text is not a number
+*/
+bool parse_number(const char* text, int& value){
+    char* end;
+    long number = strtol(text, &end, 10);
+    if(end == text || *end != 0 || number < -32768 || number > 32767){
+        return false;
+    }
+    value = number;
+    return true;
+}
+
+/*
+Store the staged setpoints if all of them are in range with their pairs as they will be after the batch
+@return bool false when nothing was stored
+*/
+bool commit_batch(){
+    int values[SETPOINT_COUNT];
+    for (int i = 0; i < SETPOINT_COUNT; ++i)
+    {
+        values[i] = (command_staged_mask & (1 << i)) ? command_staged[i] : *load_setpoint(i).value;
+    }
+    for (int i = 0; i < SETPOINT_COUNT; ++i)
+    {
+        Setpoint setpoint = load_setpoint(i);
+        if(values[i] < setpoint.min_value || values[i] > setpoint.max_value){
+            return false;
+        }
+        for (int j = 0; j < SETPOINT_COUNT; ++j)
+        {
+            int* other = load_setpoint(j).value;
+            if((other == setpoint.not_above && values[i] > values[j])
+               || (other == setpoint.not_below && values[i] < values[j])){
+                return false;
+            }
+        }
+    }
+    for (int i = 0; i < SETPOINT_COUNT; ++i)
+    {
+        *load_setpoint(i).value = values[i];
+    }
+    return true;
+}
+
+/*
+Run a command line, its tokens point into command_line
+@param char** tokens
+@param int count number of tokens
+*/
+void run_command(char** tokens, int count){
+    const char* command = tokens[0];
+    int index = (count > 1) ? find_setpoint(tokens[1]) : -1;
+    int value;
+    if(strcmp_P(command, PSTR("get")) == 0 && count == 2){
+        if(index < 0){
+            Serial.println(F("ERR name"));
+        }else{
+            print_setpoint(index);
+        }
+    }else if(strcmp_P(command, PSTR("set")) == 0 && count == 3){
+        if(index < 0){
+            Serial.println(F("ERR name"));
+        }else if(!parse_number(tokens[2], value)){
+            Serial.println(F("ERR value"));
+        }else if(command_batch){
+            command_staged[index] = value;
+            command_staged_mask |= 1 << index;
+            Serial.println(F("OK"));
+        }else{
+            set_setpoint(load_setpoint(index), value);
+            print_setpoint(index);
+        }
+    }else if(strcmp_P(command, PSTR("dump")) == 0 && count == 1){
+        command_dump_index = 0;
+    }else if(strcmp_P(command, PSTR("begin")) == 0 && count == 1){
+        command_batch = true;
+        command_staged_mask = 0;
+        Serial.println(F("OK"));
+    }else if(strcmp_P(command, PSTR("commit")) == 0 && count == 1 && command_batch){
+        command_batch = false;
+        Serial.println(commit_batch() ? F("OK") : F("ERR range"));
+    }else if(strcmp_P(command, PSTR("abort")) == 0 && count == 1){
+        command_batch = false;
+        Serial.println(F("OK"));
+    }else if(strcmp_P(command, PSTR("zone")) == 0 && count == 2){
+        if(command_batch){
+            Serial.println(F("ERR batch")); // staged sets are stored for the zone selected at commit
+        }else if(!parse_number(tokens[1], value) || value < 1 || value > ZONE_COUNT){
+            Serial.println(F("ERR value"));
+        }else{
+            selected_zone = value - 1;
+            Serial.print(F("zone="));
+            Serial.println(value);
+        }
+    }else if(strcmp_P(command, PSTR("history")) == 0 && count == 1){
+        Serial.println(F("AGE TE SM LT DI"));
+        command_history_entry = history_entry_count() > 0 ? 0 : -1;
+    }else if(strcmp_P(command, PSTR("faults")) == 0 && count == 1){
+        Serial.println(F("MIN FAULT WHAT"));
+        command_fault_entry = 0;
+    }else if(strcmp_P(command, PSTR("menu")) == 0 && count == 1){
+        push_button_event(MENU_BUTTON, BTN_PRESS);
+        push_button_event(MENU_BUTTON, BTN_RELEASE);
+        Serial.println(F("OK"));
+#if INSTRUMENTATION
+    }else if(strcmp_P(command, PSTR("stats")) == 0 && count == 1){
+        start_stats_dump();
+    }else if(strcmp_P(command, PSTR("reset")) == 0 && count == 1){
+        reset_stats();
+        Serial.println(F("OK"));
+#endif
+    }else{
+        Serial.println(F("ERR command"));
+    }
+}
+
+/* Split the received line at spaces in place and run it */
+void run_command_line(){
+    char* tokens[COMMAND_MAX_TOKENS];
+    int count = 0;
+    char* next = command_line;
+    command_line[command_length] = 0;
+    while(*next != 0){
+        if(*next == ' '){
+            *next++ = 0;
+            continue;
+        }
+        if(count == COMMAND_MAX_TOKENS){
+            Serial.println(F("ERR command"));
+            return;
+        }
+        tokens[count++] = next;
+        while(*next != 0 && *next != ' '){
+            ++next;
+        }
+    }
+    if(count > 0){
+        run_command(tokens, count);
+    }
+}
+#endif
+
+/* Read received bytes and run every complete command line, stops while replies would not fit */
+void command_task(){
+#if SERIAL_COMMANDS
+    while(Serial.availableForWrite() >= COMMAND_REPLY_SIZE){
+        if(command_dump_index >= 0){
+            print_setpoint(command_dump_index++);
+            if(command_dump_index == SETPOINT_COUNT){
+                command_dump_index = -1;
+            }
+            continue;
+        }
+        if(command_history_entry >= 0){
+            if(Serial.availableForWrite() < HISTORY_LINE_SIZE){
+                return;
+            }
+            print_history_line(command_history_entry++);
+            if(command_history_entry >= history_entry_count()){
+                command_history_entry = -1;
+            }
+            continue;
+        }
+        if(command_fault_entry >= 0){
+            SafetyFault fault;
+            if(safety_fault(command_fault_entry++, fault)){
+                safety_print_fault(Serial, fault);
+                Serial.println();
+            }else{
+                command_fault_entry = -1;
+            }
+            continue;
+        }
+        int received = Serial.read();
+        if(received < 0){
+            return;
+        }
+        if(received == '\r'){
+            continue;
+        }
+        if(received != '\n'){
+            if(command_length < COMMAND_LINE_SIZE - 1){
+                command_line[command_length++] = received;
+            }else{
+                command_overflow = true;
+            }
+            continue;
+        }
+        if(command_overflow){
+            Serial.println(F("ERR long"));
+        }else{
+            run_command_line();
+        }
+        command_length = 0;
+        command_overflow = false;
+    }
+#endif
+}
+
+/*========== Serial frames =============*/
+// Binary streams go over serial in frames that survive lost bytes and text on the same port.
+// The payload is followed by its CRC-16/CCITT, high byte first, and COBS encoded so it holds no 0 byte.
+// A 0 byte goes before and after every frame, a receiver finds the next frame after any garbage.
+
+#if TELEMETRY || RECORDING
+/* Frame being built or sent, the payload starts at index 2 after the 0 and the COBS code */
+struct Frame {
+    uint8_t* data;
+    uint8_t size; // bytes of data, COBS needs less than 254
+    uint8_t length; // bytes filled in, 0 when no frame is open
+    uint8_t send_length; // length of a finished frame being sent, 0 when none
+    uint8_t sent; // bytes of it already written to serial
+};
+
+/* Open a frame, the next frame_put() writes the first byte of the payload */
+void frame_open(Frame& frame){
+    frame.data[0] = 0;
+    frame.length = 2;
+}
+
+void frame_put(Frame& frame, uint8_t value){
+    frame.data[frame.length++] = value;
+}
+
+/* Unsigned LEB128, 7 bits a byte with the high bit set on all but the last */
+void frame_put_varint(Frame& frame, unsigned long value){
+    while(value >= 0x80){
+        frame_put(frame, (value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    frame_put(frame, value);
+}
+
+/* Zigzag keeps small negative numbers small: 0, -1, 1, -2 become 0, 1, 2, 3 */
+void frame_put_signed(Frame& frame, long value){
+    frame_put_varint(frame, value < 0 ? ~((unsigned long)value << 1) : (unsigned long)value << 1);
+}
+
+/* CRC-16/CCITT, polynomial 0x1021 */
+uint16_t crc16_update(uint16_t crc, uint8_t value){
+    crc ^= (uint16_t)value << 8;
+    for (int i = 0; i < 8; ++i)
+    {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+/* Close the open frame: add CRC, COBS encode in place and hand it to frame_send(), needs 3 free bytes */
+void frame_finish(Frame& frame){
+    uint16_t crc = 0xFFFF;
+    for (int i = 2; i < frame.length; ++i)
+    {
+        crc = crc16_update(crc, frame.data[i]);
+    }
+    frame_put(frame, crc >> 8);
+    frame_put(frame, crc & 0xFF);
+    // every 0 becomes the distance to the next one, the first distance goes in at index 1
+    uint8_t code_at = 1;
+    uint8_t code = 1;
+    for (int i = 2; i < frame.length; ++i)
+    {
+        if(frame.data[i] == 0){
+            frame.data[code_at] = code;
+            code_at = i;
+            code = 1;
+        }else{
+            ++code;
+        }
+    }
+    frame.data[code_at] = code;
+    frame_put(frame, 0);
+    frame.send_length = frame.length;
+    frame.sent = 0;
+}
+
+/*
+Write as much of the finished frame as the serial buffer takes without waiting
+@return bool true when the whole frame is sent, the frame is then free for frame_open()
+*/
+bool frame_send(Frame& frame){
+    int room = Serial.availableForWrite();
+    while(room > 0 && frame.sent < frame.send_length){
+        Serial.write(frame.data[frame.sent++]);
+        --room;
+    }
+    if(frame.sent < frame.send_length){
+        return false;
+    }
+    frame.send_length = 0;
+    frame.length = 0;
+    return true;
+}
+#endif
+
+/*========== Telemetry =============*/
+// Sensors, actuators and alerts sent over serial as binary frames, host/telemetry_decode turns them into CSV.
+// A record is taken every TELEMETRY_INTERVAL and up to TELEMETRY_BATCH records go in a frame:
+//   version, sequence, millis() of first record, interval, records dropped before it, record count
+//   first record, every field as zigzag varint
+//   other records, a byte with a bit per changed field and the zigzag varint deltas of those fields
+// Frames as in "Serial frames". Stats of INSTRUMENTATION share the port, the decoder skips them.
+
+#if TELEMETRY
+const uint8_t TELEMETRY_VERSION = 2;
+const unsigned long TELEMETRY_INTERVAL = 100; // ms between records
+const int TELEMETRY_BATCH = 10; // records in a frame, one frame a second
+const int TELEMETRY_FIELDS = 7; // distance, temperature, light, soil, lift pwm, outputs, alerts
+const int TELEMETRY_FRAME_SIZE = 97; // 0, COBS code, payload, CRC and the 0 at the end
+const int TELEMETRY_RECORD_MAX = 1 + TELEMETRY_FIELDS * 3; // change bits and a varint of at most 3 bytes per field
+// Bits of the outputs field
+const int TELEMETRY_PUMP = 1;
+const int TELEMETRY_LAMP = 2;
+
+uint8_t telemetry_buffer[TELEMETRY_FRAME_SIZE];
+Frame telemetry_frame = {telemetry_buffer, TELEMETRY_FRAME_SIZE, 0, 0, 0};
+uint8_t telemetry_count_at = 0; // index of the record count
+uint8_t telemetry_sequence = 0;
+int telemetry_last[TELEMETRY_FIELDS]; // last record, deltas are taken against it
+unsigned long telemetry_time = 0; // millis() when the last record was due
+unsigned int telemetry_dropped = 0; // records not taken since last frame because the port was busy
+
+/* Current value of every telemetry field */
+void telemetry_fields(int* fields){
+    fields[0] = current_distance;
+    fields[1] = current_temperature;
+    fields[2] = current_light_intensity;
+    fields[3] = current_soil_moisture[0]; // first zone
+    fields[4] = lift_pwm;
+    fields[5] = (pumps_running() > 0 ? TELEMETRY_PUMP : 0) | (lamp_on ? TELEMETRY_LAMP : 0);
+    fields[6] = alerts_active; // raised alerts, a bit per ALERT_*
+}
+
+/* Open a frame with the header of the record at time */
+void telemetry_start(unsigned long time){
+    frame_open(telemetry_frame);
+    frame_put(telemetry_frame, TELEMETRY_VERSION);
+    frame_put(telemetry_frame, telemetry_sequence++);
+    frame_put_varint(telemetry_frame, time);
+    frame_put_varint(telemetry_frame, TELEMETRY_INTERVAL);
+    frame_put_varint(telemetry_frame, telemetry_dropped);
+    telemetry_dropped = 0;
+    telemetry_count_at = telemetry_frame.length;
+    frame_put(telemetry_frame, 0);
+}
+
+/* Add a record to the open frame */
+void telemetry_add(){
+    int fields[TELEMETRY_FIELDS];
+    telemetry_fields(fields);
+    if(telemetry_frame.data[telemetry_count_at]++ == 0){
+        for (int i = 0; i < TELEMETRY_FIELDS; ++i)
+        {
+            frame_put_signed(telemetry_frame, fields[i]);
+        }
+    }else{
+        uint8_t changes_at = telemetry_frame.length;
+        uint8_t changes = 0;
+        frame_put(telemetry_frame, 0);
+        for (int i = 0; i < TELEMETRY_FIELDS; ++i)
+        {
+            if(fields[i] != telemetry_last[i]){
+                changes |= 1 << i;
+                frame_put_signed(telemetry_frame, (long)fields[i] - telemetry_last[i]);
+            }
+        }
+        telemetry_frame.data[changes_at] = changes;
+    }
+    memcpy(telemetry_last, fields, sizeof(fields));
+}
+#endif
+
+/* Take a record every TELEMETRY_INTERVAL and send full frames, records are dropped while the port is busy */
+void telemetry_task(){
+#if TELEMETRY
+    if(telemetry_frame.send_length > 0){
+        frame_send(telemetry_frame);
+    }
+    unsigned long now = millis();
+    if(now - telemetry_time < TELEMETRY_INTERVAL){
+        return;
+    }
+    // records stay on a TELEMETRY_INTERVAL grid unless the task fell far behind
+    telemetry_time = (now - telemetry_time < 2 * TELEMETRY_INTERVAL) ? telemetry_time + TELEMETRY_INTERVAL : now;
+    if(telemetry_frame.send_length > 0){
+        ++telemetry_dropped;
+        return;
+    }
+    if(telemetry_frame.length == 0){
+        telemetry_start(telemetry_time);
+    }
+    telemetry_add();
+    if(telemetry_frame.data[telemetry_count_at] == TELEMETRY_BATCH
+       || telemetry_frame.length + TELEMETRY_RECORD_MAX + 3 > TELEMETRY_FRAME_SIZE){
+        frame_finish(telemetry_frame);
+        frame_send(telemetry_frame);
+    }
+#endif
+}
+
+/*========== Recording =============*/
+// Every input of the control logic goes over serial when it changes, so the run of a unit in
+// the field can be replayed on the host, see host/trace_replay.cpp. water_plants(), keep_gap(),
+// check_light() and alert() see the sensors only after their filters, so the inputs are the
+// filtered values and states of the sensors, the setpoints and the button events.
+// Frames as in "Serial frames", the payload is
+//   version, sequence, zone count, events recorded late before the frame, millis() of the frame
+//   events: ms since the previous event or the frame time, input, its value as zigzag varint
+// Every input is recorded every RECORD_KEY_TIME as well, a replay can start at any of these.
+
+const int RECORD_TEMPERATURE = 0; // inputs, current_temperature
+const int RECORD_LIGHT = 1; // current_light_intensity
+const int RECORD_DISTANCE = 2; // current_distance
+const int RECORD_SENSOR_STATE = 3; // RECORD_*_OK bits
+const int RECORD_SOIL = 4; // current_soil_moisture_tenths of zone 0, the other zones follow
+const int RECORD_SETPOINT = RECORD_SOIL + ZONE_COUNT; // values of SETPOINTS in their order, per zone ones for every zone
+const int RECORD_INPUT_COUNT = RECORD_SETPOINT + SETPOINT_COUNT - 1 + ZONE_COUNT; // soil is the only per zone setpoint
+const int RECORD_BUTTON = 255; // not an input, a button event as queued by scan_buttons()
+// Bits of the sensor state
+const int RECORD_TEMPERATURE_OK = 1;
+const int RECORD_DISTANCE_VALID = 2;
+const int RECORD_DISTANCE_STUCK = 4;
+const int RECORD_SOIL_OK = 8; // zone 0, the other zones follow
+
+static_assert(RECORD_INPUT_COUNT <= 32, "inputs do not fit record_pending");
+
+/*
+Variable of a setpoint value
+@param int index value index after RECORD_SETPOINT
+@return int* 0 when there is no such value
+*/
+int* record_setpoint(int index){
+    for (int i = 0; i < SETPOINT_COUNT; ++i)
+    {
+        Setpoint setpoint;
+        memcpy_P(&setpoint, &SETPOINTS[i], sizeof(Setpoint));
+        int values = setpoint.per_zone ? ZONE_COUNT : 1;
+        if(index < values){
+            return setpoint.value + index;
+        }
+        index -= values;
+    }
+    return 0;
+}
+
+/* Current value of every input */
+void record_inputs(int* values){
+    values[RECORD_TEMPERATURE] = current_temperature;
+    values[RECORD_LIGHT] = current_light_intensity;
+    values[RECORD_DISTANCE] = current_distance;
+    int state = (temperature_sensor_ok ? RECORD_TEMPERATURE_OK : 0) | (distance_valid ? RECORD_DISTANCE_VALID : 0)
+        | (distance_filter.stuck ? RECORD_DISTANCE_STUCK : 0);
+    for (int zone = 0; zone < ZONE_COUNT; ++zone)
+    {
+        values[RECORD_SOIL + zone] = current_soil_moisture_tenths[zone];
+        if(soil_sensor_ok[zone]){
+            state |= RECORD_SOIL_OK << zone;
+        }
+    }
+    values[RECORD_SENSOR_STATE] = state;
+    for (int i = RECORD_SETPOINT; i < RECORD_INPUT_COUNT; ++i)
+    {
+        values[i] = *record_setpoint(i - RECORD_SETPOINT);
+    }
+}
+
+#if !defined(__AVR__)
+/*
+Set an input as the recording saw it, for the replay on the host
+@param int input RECORD_* input or RECORD_BUTTON
+@param int value
+*/
+void record_apply(int input, int value){
+    if(input == RECORD_BUTTON){
+        push_button_event(value >> 4, value & 0x0F);
+    }else if(input == RECORD_TEMPERATURE){
+        current_temperature = value;
+    }else if(input == RECORD_LIGHT){
+        current_light_intensity = value;
+    }else if(input == RECORD_DISTANCE){
+        current_distance = value;
+    }else if(input == RECORD_SENSOR_STATE){
+        temperature_sensor_ok = value & RECORD_TEMPERATURE_OK;
+        distance_valid = value & RECORD_DISTANCE_VALID;
+        distance_filter.stuck = value & RECORD_DISTANCE_STUCK;
+        for (int zone = 0; zone < ZONE_COUNT; ++zone)
+        {
+            soil_sensor_ok[zone] = value & (RECORD_SOIL_OK << zone);
+        }
+    }else if(input >= RECORD_SOIL && input < RECORD_SETPOINT){
+        current_soil_moisture_tenths[input - RECORD_SOIL] = value;
+        current_soil_moisture[input - RECORD_SOIL] = value / 10; // both truncate the same reading
+    }else if(input >= RECORD_SETPOINT && input < RECORD_INPUT_COUNT){
+        *record_setpoint(input - RECORD_SETPOINT) = value;
+    }
+}
+#endif
+
+#if RECORDING
+const uint8_t RECORD_VERSION = 3; // own numbering, kept above TELEMETRY_VERSION (2) so the two streams are told apart
+const int RECORD_FRAME_SIZE = 64;
+const int RECORD_EVENT_MAX = 7; // time varint of at most 3 bytes, input, value varint of at most 3 bytes
+const unsigned long RECORD_FLUSH_TIME = 1000; // ms an open frame waits for more events
+const unsigned long RECORD_KEY_TIME = 60000; // ms between two records of every input
+
+static_assert(!TELEMETRY, "telemetry and recording frames would mix on the serial port");
+
+uint8_t record_buffers[2][RECORD_FRAME_SIZE];
+Frame record_frames[2] = {
+    {record_buffers[0], RECORD_FRAME_SIZE, 0, 0, 0},
+    {record_buffers[1], RECORD_FRAME_SIZE, 0, 0, 0},
+};
+uint8_t record_filling = 0; // frame events go into, the other one may still be sending
+uint8_t record_sequence = 0;
+int record_last[RECORD_INPUT_COUNT]; // values last recorded
+uint32_t record_pending = 0xFFFFFFFFUL; // bit per input to record, all of them at start
+unsigned long record_time = 0; // millis() of the last event in the open frame
+unsigned long record_frame_time = 0; // millis() when the open frame was started
+unsigned long record_key_time = 0; // millis() when every input was last recorded
+unsigned int record_late = 0; // events held back since the last frame because both frames were busy
+uint8_t record_button_tail = 0; // button_queue entries before it are recorded
+
+/* Finish the open frame and start sending it, false while the other frame is still being sent */
+bool record_flush(){
+    Frame& other = record_frames[record_filling ^ 1];
+    if(other.send_length > 0 && !frame_send(other)){
+        return false;
+    }
+    frame_finish(record_frames[record_filling]);
+    frame_send(record_frames[record_filling]);
+    record_filling ^= 1;
+    return true;
+}
+
+/*
+Add an event to the open frame, a full frame is flushed first
+@param unsigned long now millis()
+@param int input RECORD_* input or RECORD_BUTTON
+@param int value
+@return bool false when both frames are busy
+*/
+bool record_event(unsigned long now, int input, int value){
+    if(record_frames[record_filling].length + RECORD_EVENT_MAX + 3 > RECORD_FRAME_SIZE && !record_flush()){
+        ++record_late;
+        return false;
+    }
+    Frame& frame = record_frames[record_filling];
+    if(frame.length == 0){
+        frame_open(frame);
+        frame_put(frame, RECORD_VERSION);
+        frame_put(frame, record_sequence++);
+        frame_put(frame, ZONE_COUNT);
+        frame_put_varint(frame, record_late);
+        frame_put_varint(frame, now);
+        record_late = 0;
+        record_time = now;
+        record_frame_time = now;
+    }
+    frame_put_varint(frame, now - record_time);
+    frame_put(frame, input);
+    frame_put_signed(frame, value);
+    record_time = now;
+    return true;
+}
+#endif
+
+/*
+Record inputs that changed and new button events, runs in the same loop() pass as the tasks that
+change them so a replay gets every input at the millis() it changed. Inputs that found both frames
+busy are recorded on a later run, button events are lost then.
+*/
+void record_task(){
+#if RECORDING
+    Frame& other = record_frames[record_filling ^ 1];
+    if(other.send_length > 0){
+        frame_send(other);
+    }
+    unsigned long now = millis();
+    if(now - record_key_time >= RECORD_KEY_TIME){
+        record_key_time = now;
+        record_pending = 0xFFFFFFFFUL;
+    }
+    int values[RECORD_INPUT_COUNT];
+    record_inputs(values);
+    for (int i = 0; i < RECORD_INPUT_COUNT; ++i)
+    {
+        if(values[i] != record_last[i]){
+            record_pending |= 1UL << i;
+        }
+        if((record_pending & (1UL << i)) && record_event(now, i, values[i])){
+            record_pending &= ~(1UL << i);
+            record_last[i] = values[i];
+        }
+    }
+    while(record_button_tail != button_queue_head){
+        record_event(now, RECORD_BUTTON, button_queue[record_button_tail]);
+        record_button_tail = (record_button_tail + 1) & (BTN_QUEUE_SIZE - 1);
+    }
+    if(record_frames[record_filling].length > 0 && now - record_frame_time >= RECORD_FLUSH_TIME){
+        record_flush();
+    }
+#endif
+}
+
+/*
+Run every task which period has passed
+@return bool true when a task ran
+*/
+bool run_tasks(){
+    bool worked = false;
+    for (int i = 0; i < TASK_COUNT; ++i)
+    {
+        unsigned long current_milliseconds = millis();
+        unsigned long elapsed = current_milliseconds - tasks[i].last_run;
+        if(elapsed >= tasks[i].period){
+            if(elapsed - tasks[i].period > tasks[i].deadline){
+                ++tasks[i].missed;
+            }
+            STAGE_LATE(i, elapsed - tasks[i].period);
+            // runs stay on a grid of the period, tasks with a common multiple wake the CPU together
+            tasks[i].last_run = (elapsed < 2 * tasks[i].period) ? tasks[i].last_run + tasks[i].period : current_milliseconds;
+            STAGE_BEGIN(task_start);
+            safety_running_task = i;
+            tasks[i].run();
+            safety_running_task = SAFETY_NO_TASK;
+            STAGE_END(i, task_start);
+            worked = true;
+        }
+    }
+    return worked;
+}
+
+/* true when a task is due now */
+bool task_due(){
+    unsigned long current_milliseconds = millis();
+    for (int i = 0; i < TASK_COUNT; ++i)
+    {
+        if(current_milliseconds - tasks[i].last_run >= tasks[i].period){
+            return true;
+        }
+    }
+    return false;
+}
+
+void loop() {
+    STAGE_BEGIN(loop_start);
+    bool worked = run_tasks();
+    safety_feed();
+    STAGE_END(LOOP_STAGE, loop_start);
+    if(!task_due()){
+        idle_sleep(worked);
+    }
 }